@@ -84,24 +84,31 @@ class Blob {
     return data_;
   }
 
+  /**
+   * @brief The SyncedMemory holding the diff, created on first use.
+   *
+   * Reshape only creates the data of a Blob, so the Blob%s of a Net that
+   * only runs Forward, such as a TEST net, never hold diff memory.
+   */
   inline const shared_ptr<SyncedMemory>& diff() const {
-    CHECK(diff_);
+    if (!diff_) {
+      CHECK(data_);
+      diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
+    }
     return diff_;
   }
+  /// @brief Whether the diff was created, without creating it.
+  inline bool has_diff() const { return diff_.get() != NULL; }
 
   const Dtype* cpu_data() const;
   void set_cpu_data(Dtype* data);
   const Dtype* gpu_data() const;
   const Dtype* cpu_diff() const;
   const Dtype* gpu_diff() const;
-  const Dtype* cpu_acum_diff() const;
-  const Dtype* gpu_acum_diff() const;
   Dtype* mutable_cpu_data();
   Dtype* mutable_gpu_data();
   Dtype* mutable_cpu_diff();
   Dtype* mutable_gpu_diff();
-  Dtype* mutable_gpu_acum_diff();
-  Dtype* mutable_cpu_acum_diff();
   void Update();
   void FromProto(const BlobProto& proto);
   void ToProto(BlobProto* proto, bool write_diff = false) const;
@@ -111,10 +118,6 @@ class Blob {
   /// @brief Compute the sum of absolute values (L1 norm) of the diff.
   Dtype asum_diff() const;
 
-  // added for allowing bigger batch_size
-  void AccumulateDiff();
-  void UpdateDiff();
-
   /**
    * @brief Set the data_ shared_ptr to point to the SyncedMemory holding the
    *        data_ of Blob other -- useful in Layer&s which simply perform a copy
@@ -133,11 +136,21 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Set the data_ (or diff_) shared_ptr to point to a SyncedMemory of
+   *        at least count() elements, such as one shared by the Blob%s of a
+   *        Net whose lifetimes do not overlap.
+   *
+   * The memory is used until a Reshape needs more than the previous
+   * capacity of this Blob.
+   */
+  void set_data(const shared_ptr<SyncedMemory>& data);
+  void set_diff(const shared_ptr<SyncedMemory>& diff);
 
  protected:
   shared_ptr<SyncedMemory> data_;
-  shared_ptr<SyncedMemory> diff_;
-  shared_ptr<SyncedMemory> acum_diff_;
+  // The diff is created on first use by diff().
+  mutable shared_ptr<SyncedMemory> diff_;
   int num_;
   int channels_;
   int height_;
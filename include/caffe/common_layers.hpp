@@ -150,6 +150,54 @@ class ConcatLayer : public Layer<Dtype> {
   int concat_dim_;
 };
 
+/**
+ * @brief Averages each group of num_crops consecutive items of each input,
+ *        such as the predictions for the test_crops of an image. The data
+ *        layer only takes its test_crops in nets built in the TEST phase.
+ */
+template <typename Dtype>
+class CropAverageLayer : public Layer<Dtype> {
+ public:
+  explicit CropAverageLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  virtual inline LayerParameter_LayerType type() const {
+    return LayerParameter_LayerType_CROP_AVERAGE;
+  }
+  virtual inline int MinBottomBlobs() const { return 1; }
+  virtual inline bool EqualNumBottomTopBlobs() const { return true; }
+
+ protected:
+  /**
+   * @param bottom input Blob vector (length 1+)
+   *   -# @f$ (KN \times C \times H \times W) @f$
+   *      the inputs @f$ x @f$, K = num_crops consecutive items per output
+   * @param top output Blob vector (as many as the inputs)
+   *   -# @f$ (N \times C \times H \times W) @f$
+   *      the averages @f$ y_n = \frac{1}{K} \sum_{k=0}^{K-1} x_{Kn+k} @f$
+   */
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  /**
+   * @brief Spreads the error gradient of each output evenly over the items
+   *        it averages: @f$
+   *        \frac{\partial E}{\partial x_{Kn+k}} =
+   *        \frac{1}{K} \frac{\partial E}{\partial y_n} @f$.
+   */
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom);
+
+  int num_crops_;
+};
+
 /**
  * @brief Compute elementwise operations, such as product and sum,
  *        along multiple input Blobs.
@@ -212,6 +260,7 @@ class FlattenLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool SharesBlobMemory() const { return true; }
 
  protected:
   /**
@@ -431,6 +480,7 @@ class SplitLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline bool SharesBlobMemory() const { return true; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -1,28 +1,42 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <algorithm>
+#include <deque>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "boost/scoped_ptr.hpp"
 #include "hdf5.h"
-#include "leveldb/db.h"
-#include "lmdb.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#include "caffe/data_reader.hpp"
 #include "caffe/data_transformer.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/image_reader.hpp"
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/flat_dataset.hpp"
+#include "caffe/util/image_cache.hpp"
 
 namespace caffe {
 
 #define HDF5_DATA_DATASET_NAME "data"
 #define HDF5_DATA_LABEL_NAME "label"
 
+// The records [*begin, *end) of shard shard_id of num_shards of a RANGE
+// split of num records.
+void GetShardRange(int num, int shard_id, int num_shards, int* begin,
+    int* end);
+// The records, in increasing order, of shard shard_id of num_shards of a
+// split of num records.
+void GetShardRecords(int num, int shard_id, int num_shards,
+    DataParameter::ShardMode mode, vector<int>* records);
+
 /**
  * @brief Provides base for data layers that feed blobs to the Net.
  *
@@ -43,6 +57,8 @@ class BaseDataLayer : public Layer<Dtype> {
   // Data layers have no bottoms, so reshaping is trivial.
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {}
+  // The tops may be set to the memory of the data layer.
+  virtual inline bool SharesBlobMemory() const { return true; }
 
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
@@ -67,13 +83,34 @@ class BaseDataLayer : public Layer<Dtype> {
   bool output_labels_;
 };
 
+template <typename Dtype>
+class Batch {
+ public:
+  Blob<Dtype> data_, label_;
+};
+
+/**
+ * @brief Provides base for data layers that prefetch batches on a separate
+ *        thread.
+ *
+ * The prefetch thread runs for the lifetime of the layer and cycles
+ * data_param().prefetch() preallocated batches: it takes a free batch, fills
+ * it with LoadBatch and queues it for Forward. Forward does not copy the
+ * batch: the top blobs share its memory until the next Forward, which hands
+ * the batch back to the prefetch thread.
+ *
+ * LoadBatch may split the work on a batch across transform_param().threads()
+ * threads with FillBatchInParallel: the batch is cut into that many
+ * contiguous slices and slice i is always filled with the i-th
+ * DataTransformer, so the random crops and mirrors are reproducible for a
+ * given seed no matter how the threads are scheduled.
+ */
 template <typename Dtype>
 class BasePrefetchingDataLayer :
     public BaseDataLayer<Dtype>, public InternalThread {
  public:
-  explicit BasePrefetchingDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Dtype>(param) {}
-  virtual ~BasePrefetchingDataLayer() {}
+  explicit BasePrefetchingDataLayer(const LayerParameter& param);
+  virtual ~BasePrefetchingDataLayer();
   // LayerSetUp: implements common data layer setup functionality, and calls
   // DataLayerSetUp to do special data layer setup for individual layer types.
   // This method may not be overridden.
@@ -86,20 +123,87 @@ class BasePrefetchingDataLayer :
       vector<Blob<Dtype>*>* top);
 
   virtual void CreatePrefetchThread();
-  virtual void JoinPrefetchThread();
-  // The thread's function
-  virtual void InternalThreadEntry() {}
+  // Stops the prefetch thread. The subclasses must call it in their
+  // destructor, before the state LoadBatch uses goes away.
+  virtual void StopPrefetchThread();
 
  protected:
-  Blob<Dtype> prefetch_data_;
-  Blob<Dtype> prefetch_label_;
+  // The thread's function: fills free batches until asked to stop.
+  virtual void InternalThreadEntry();
+  // Fills batch, which the subclasses have shaped in DataLayerSetUp.
+  virtual void LoadBatch(Batch<Dtype>* batch) = 0;
+  // Fills items [item_begin, item_end) of the batch whose data and labels
+  // start at top_data and top_label (NULL if there are no labels). Called by
+  // FillBatchInParallel concurrently for the disjoint slices of a batch;
+  // slice_id selects the transformer the slice must use.
+  virtual void FillBatchSlice(const int slice_id, const int item_begin,
+      const int item_end, Dtype* top_data, Dtype* top_label) {}
+  // Fills batch with FillBatchSlice, running the first slice on the calling
+  // thread and the others on the prefetch workers.
+  void FillBatchInParallel(Batch<Dtype>* batch);
+  // Hands the current batch back to the prefetch thread and makes the top
+  // blobs share the next one.
+  Batch<Dtype>* ShareNextBatch(vector<Blob<Dtype>*>* top);
+  DataTransformer<Dtype>* slice_transformer(const int slice_id);
+  // Writes the label of input item_id to the num_crops items made from it.
+  static void SetLabel(const int item_id, const Dtype label,
+      const int num_crops, Dtype* top_label) {
+    std::fill(top_label + item_id * num_crops,
+        top_label + (item_id + 1) * num_crops, label);
+  }
+
+  vector<shared_ptr<Batch<Dtype> > > prefetch_;
+  BlockingQueue<Batch<Dtype>*> prefetch_free_;
+  BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  // The batch the top blobs currently share, if any.
+  Batch<Dtype>* current_batch_;
+
+ private:
+  class PrefetchWorker : public InternalThread {
+   public:
+    explicit PrefetchWorker(BasePrefetchingDataLayer<Dtype>* layer)
+        : layer_(layer) {}
+   protected:
+    virtual void InternalThreadEntry() { layer_->RunPrefetchWorker(); }
+    BasePrefetchingDataLayer<Dtype>* layer_;
+  };
+
+  void FillSlice(const int slice_id);
+  void RunPrefetchWorker();
+  // Stops the prefetch thread and workers and requeues all the batches.
+  void ResetPrefetch();
+
+  // The transformers of slices 1 and up; slice 0 uses data_transformer_.
+  vector<shared_ptr<DataTransformer<Dtype> > > slice_transformers_;
+  vector<shared_ptr<PrefetchWorker> > prefetch_workers_;
+  // Slice ids handed to the workers (-1 asks a worker to exit), and the ids
+  // of the slices they have filled.
+  BlockingQueue<int> pending_slices_;
+  BlockingQueue<int> filled_slices_;
+  int slice_batch_size_;
+  Dtype* slice_data_;
+  Dtype* slice_label_;
 };
 
+/**
+ * @brief Provides data to the Net from LevelDB, LMDB or record file databases,
+ *        or from FlatDataset files.
+ *
+ * The source database and any shard_source are each read by
+ * readers_per_source DataReader threads, and the batches take one record
+ * from each reader in turn. FlatDatasets need no readers: the prefetch
+ * workers transform their records straight from the mapped files. So do
+ * databases with cache_in_memory, from the memory they are loaded in. With
+ * shuffle the records of each database are read in a new random order every
+ * epoch. With num_shards > 1 the layer only reads its shard_id of the
+ * records of each database, so that data parallel processes read disjoint
+ * data.
+ */
 template <typename Dtype>
 class DataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit DataLayer(const LayerParameter& param)
-      : BasePrefetchingDataLayer<Dtype>(param) {}
+      : BasePrefetchingDataLayer<Dtype>(param), next_reader_(0) {}
   virtual ~DataLayer();
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
@@ -112,17 +216,32 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int MaxTopBlobs() const { return 2; }
 
  protected:
-  virtual void InternalThreadEntry();
-
-  // LEVELDB
-  shared_ptr<leveldb::DB> db_;
-  shared_ptr<leveldb::Iterator> iter_;
-  // LMDB
-  MDB_env* mdb_env_;
-  MDB_dbi mdb_dbi_;
-  MDB_txn* mdb_txn_;
-  MDB_cursor* mdb_cursor_;
-  MDB_val mdb_key_, mdb_value_;
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  virtual void FillBatchSlice(const int slice_id, const int item_begin,
+      const int item_end, Dtype* top_data, Dtype* top_label);
+  // The keys of a database in database order, for the shuffled readers.
+  static void ReadKeys(db::DB* db, vector<string>* keys);
+  void ShuffleFlatDataset(const int i);
+  void FillFlatBatchSlice(DataTransformer<Dtype>* transformer,
+      const int item_begin, const int item_end, Dtype* top_data,
+      Dtype* top_label);
+
+  // The serialized Datums of the batch being prefetched.
+  vector<string> prefetch_values_;
+  // The readers of all the shards; the batches take one record from each
+  // reader, or each flat dataset, in turn.
+  vector<shared_ptr<DataReader> > readers_;
+  int next_reader_;
+  // FLAT backend or cache_in_memory: the datasets of all the shards, the next
+  // record of each, and the (dataset, record) pairs of the batch being
+  // prefetched. The positions index the records of each dataset read by
+  // this layer's shard_id, in a permutation drawn again every epoch with
+  // shuffle.
+  vector<shared_ptr<FlatDataset> > flat_datasets_;
+  vector<int> flat_positions_;
+  vector<vector<int> > flat_orders_;
+  shared_ptr<Caffe::RNG> flat_rng_;
+  vector<std::pair<int, int> > prefetch_records_;
 };
 
 /**
@@ -146,6 +265,8 @@ class DummyDataLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int MinTopBlobs() const { return 1; }
+  // The tops that are not refilled keep their data from setup on.
+  virtual inline bool SharesBlobMemory() const { return true; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -162,19 +283,20 @@ class DummyDataLayer : public Layer<Dtype> {
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * The files listed in the source are streamed by the prefetch thread: it
+ * reads the "data" and "label" datasets chunk_size rows at a time with
+ * hyperslab selections, so that neither the memory used nor the stall at the
+ * start of a file depends on the size of the files. With shuffle the files
+ * are read in a new random order every epoch.
  */
 template <typename Dtype>
-class HDF5DataLayer : public Layer<Dtype> {
+class HDF5DataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : BasePrefetchingDataLayer<Dtype>(param), file_id_(-1) {}
   virtual ~HDF5DataLayer();
-  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
-  // Data layers have no bottoms, so reshaping is trivial.
-  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) {}
 
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_HDF5_DATA;
@@ -183,22 +305,29 @@ class HDF5DataLayer : public Layer<Dtype> {
   virtual inline int ExactNumTopBlobs() const { return 2; }
 
  protected:
-  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top);
-  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top);
-  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
-  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {}
-  virtual void LoadHDF5FileData(const char* filename);
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  // Opens a file and checks that its datasets have the shape of the tops.
+  virtual void OpenHDF5File(const char* filename);
+  void CloseHDF5File();
+  // Reads the next chunk of rows, moving on to the next file at the end of
+  // the current one.
+  virtual void LoadHDF5Chunk();
+  void ShuffleFiles();
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
+  // The position of the current file in file_permutation_.
   unsigned int current_file_;
+  std::vector<unsigned int> file_permutation_;
+  shared_ptr<Caffe::RNG> shuffle_rng_;
+  hid_t file_id_;
+  hsize_t file_rows_;
+  // The next row of the current file to read.
   hsize_t current_row_;
+  // The chunk read last, and the next of its rows to copy to a batch.
   Blob<Dtype> data_blob_;
   Blob<Dtype> label_blob_;
+  int chunk_row_;
 };
 
 /**
@@ -266,10 +395,26 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  virtual void FillBatchSlice(const int slice_id, const int item_begin,
+      const int item_end, Dtype* top_data, Dtype* top_label);
+  // Returns the next line of the list, shuffling it again at every epoch.
+  std::pair<std::string, int> NextLine();
+  // Queues the next line of the list to the next reader.
+  void ReadAhead();
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
+  // The images and labels of the batch being prefetched, and with readers,
+  // the bytes of the image files.
+  vector<std::pair<std::string, int> > prefetch_lines_;
+  vector<string> prefetch_files_;
+  // The readers, fed and popped round-robin, and the lines they are reading
+  // in order.
+  vector<shared_ptr<ImageReader> > readers_;
+  int next_read_;
+  int next_pop_;
+  std::deque<std::pair<std::string, int> > readahead_lines_;
 };
 
 /**
@@ -336,13 +481,21 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual unsigned int PrefetchRand();
-  virtual void InternalThreadEntry();
+  virtual void LoadBatch(Batch<Dtype>* batch);
+  virtual void FillBatchSlice(const int slice_id, const int item_begin,
+      const int item_end, Dtype* top_data, Dtype* top_label);
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int> > > image_database_;
   enum WindowField { IMAGE_INDEX, LABEL, OVERLAP, X1, Y1, X2, Y2, NUM };
   vector<vector<float> > fg_windows_;
   vector<vector<float> > bg_windows_;
+  // The windows sampled for the batch being prefetched, and whether each of
+  // them is mirrored.
+  vector<vector<float> > prefetch_windows_;
+  vector<bool> prefetch_mirror_;
+  // The decoded images, shared by the prefetch workers, if image_cache_mb.
+  shared_ptr<ImageCache> image_cache_;
 };
 
 }  // namespace caffe
@@ -0,0 +1,95 @@
+#ifndef CAFFE_DATA_READER_HPP_
+#define CAFFE_DATA_READER_HPP_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/db.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Reads the serialized Datums of a db::DB on its own thread and
+ *        queues them for a DataLayer.
+ *
+ * A reader created with offset r and step n reads records r, r + n,
+ * r + 2n... of the database, so n readers with offsets 0 to n - 1 split the
+ * database between them. At the end of the database the reader restarts
+ * from record r. A reader given a range of records [begin, end) reads
+ * records begin + r, begin + r + n... before end instead.
+ *
+ * A reader given the keys of its records instead reads them in a random
+ * order, drawn again at every epoch. To keep the reads local, the order is
+ * taken shuffle_window records at a time and each window is read in database
+ * order before it is queued in the random order. The keys are indexed by the
+ * caller, so that one walk of the database serves all its readers.
+ */
+class DataReader : public InternalThread {
+ public:
+  // Starts skip records of the reader past record offset, that is skip * step
+  // records of the database, and reads ahead at most queue_size records. An
+  // end of -1 is the end of the database.
+  DataReader(const shared_ptr<db::DB>& db, int offset, int step, int skip,
+      int queue_size, int begin = 0, int end = -1);
+  // Reads the records of the keys, in database order, in a random order,
+  // starting skip keys into it. The keys are swapped out of the vector.
+  DataReader(const shared_ptr<db::DB>& db, vector<string>* keys, int skip,
+      int queue_size, int shuffle_window);
+  virtual ~DataReader();
+
+  // Blocks until the next record is read and returns it, without consuming
+  // it.
+  const string& Peek();
+  // Blocks until the next record is read and moves it into value.
+  void Pop(string* value);
+
+ protected:
+  virtual void InternalThreadEntry();
+  // Moves the cursor to the first record of the reader. Only the first
+  // Rewind walks the database up to it, later ones seek to its key.
+  void Rewind();
+  // Moves the cursor step records on, to the next record of the reader,
+  // rewinding at the end of the database or of the range.
+  void NextRecord();
+  // Moves the cursor to the next record of the database and returns false
+  // at the end of it, or of the range.
+  bool Step();
+  // Reads the next window of the shuffled keys and queues its records.
+  void ReadShuffledWindow();
+  void ShuffleKeys();
+  void InitQueue(int queue_size);
+
+  shared_ptr<db::DB> db_;
+  shared_ptr<db::Cursor> cursor_;
+  int offset_;
+  int step_;
+  int begin_;
+  int end_;
+  // The index of the record under the cursor.
+  int position_;
+  // The key of the first record of the reader, once found, unless it is the
+  // first record of the database.
+  string first_key_;
+  vector<shared_ptr<string> > buffers_;
+  BlockingQueue<string*> free_;
+  BlockingQueue<string*> full_;
+  // Shuffled reads: the keys of the reader in database order, the order in
+  // which the current epoch reads them and the position in that order.
+  int shuffle_window_;
+  vector<string> keys_;
+  vector<int> order_;
+  int next_key_;
+  vector<std::pair<int, int> > window_;
+  vector<string> window_values_;
+  shared_ptr<Caffe::RNG> rng_;
+
+  DISABLE_COPY_AND_ASSIGN(DataReader);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_DATA_READER_HPP_
@@ -1,9 +1,18 @@
 #ifndef CAFFE_DATA_TRANSFORMER_HPP
 #define CAFFE_DATA_TRANSFORMER_HPP
 
+#include <stdint.h>
+
+#include <vector>
+
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 
+namespace cv {
+// Forward declaration for cv::Mat to keep OpenCV out of this header.
+class Mat;
+}
+
 namespace caffe {
 
 /**
@@ -13,24 +22,31 @@ namespace caffe {
 template <typename Dtype>
 class DataTransformer {
  public:
-  explicit DataTransformer(const TransformationParameter& param)
-    : param_(param) {
-    phase_ = Caffe::phase();
-  }
+  explicit DataTransformer(const TransformationParameter& param);
   virtual ~DataTransformer() {}
 
   void InitRand();
 
+  /**
+   * @brief The number of top items each input is transformed into: the
+   * test_crops if the transformer was built in the TEST phase, 1 otherwise.
+   * Data layers make their batches this many times larger.
+   */
+  int num_crops() const { return num_crops_; }
+
   /**
    * @brief Applies the transformation defined in the data layer's
    * transform_param block to the data.
    *
    * @param batch_item_id
    *    Datum position within the batch. This is used to compute the
-   *    writing position in the top blob's data
+   *    writing position in the top blob's data: with num_crops() crops, the
+   *    datum is written to the items batch_item_id * num_crops() onwards.
    * @param datum
    *    Datum containing the data to be transformed.
    * @param mean
+   *    The mean image, of the size of the datum. It is not used if the
+   *    transform_param has mean_values.
    * @param transformed_data
    *    This is meant to be the top blob's data. The transformed data will be
    *    written at the appropriate place within the blob's data.
@@ -38,12 +54,85 @@ class DataTransformer {
   void Transform(const int batch_item_id, const Datum& datum,
                  const Dtype* mean, Dtype* transformed_data);
 
+  /**
+   * @brief Applies the transformation to an image stored as channels x
+   * height x width bytes or floats, such as a record of a FlatDataset, in
+   * the same way as to a Datum.
+   */
+  void Transform(const int batch_item_id, const uint8_t* data,
+                 const int channels, const int height, const int width,
+                 const Dtype* mean, Dtype* transformed_data);
+  void Transform(const int batch_item_id, const float* data,
+                 const int channels, const int height, const int width,
+                 const Dtype* mean, Dtype* transformed_data);
+
+  /**
+   * @brief Applies the transformation to an 8-bit image decoded by OpenCV,
+   * reading its interleaved channels in place instead of going through a
+   * Datum first. The mean is still an image of channels x rows x cols.
+   */
+  void Transform(const int batch_item_id, const cv::Mat& cv_img,
+                 const Dtype* mean, Dtype* transformed_data);
+
  protected:
+  // Transforms data whose element (c, h, w) is at
+  // c * channel_step + h * row_step + w * pixel_step.
+  template <typename T>
+  void TransformData(const int batch_item_id, const T* data,
+                     const int channels, const int height, const int width,
+                     const int channel_step, const int row_step,
+                     const int pixel_step, const Dtype* mean,
+                     Dtype* transformed_data);
+
+  // Transforms the top_height x top_width crop of the data at (h_off, w_off)
+  // into the item top_item_id of the top, applying the photometric
+  // augmentations drawn if photometric.
+  template <typename T>
+  void TransformCrop(const int top_item_id, const T* data,
+                     const int channels, const int height, const int width,
+                     const int channel_step, const int row_step,
+                     const int pixel_step, const int h_off, const int w_off,
+                     const int top_height, const int top_width,
+                     const bool do_mirror, const bool photometric,
+                     const Dtype* mean, Dtype* transformed_data);
+
+  // Draws the geometric augmentations of an image, for a top of
+  // top_height x top_width, and its photometric ones.
+  void DrawAugmentation(const int channels, const int height, const int width,
+                        const int top_height, const int top_width);
+  // Samples the top from the data through the augmentations drawn, when
+  // they include geometric ones.
+  template <typename T>
+  void TransformAugmented(const int batch_item_id, const T* data,
+                          const int channels, const int height,
+                          const int width, const int channel_step,
+                          const int row_step, const int pixel_step,
+                          const int top_height, const int top_width,
+                          const Dtype* mean, Dtype* transformed_data);
+
   virtual unsigned int Rand();
+  // A uniform random number in [min, max).
+  float RandUniform(const float min, const float max);
 
   // Tranformation parameters
   TransformationParameter param_;
-
+  // The mean_values, and a row of the one of the channel being transformed.
+  vector<Dtype> mean_values_;
+  vector<Dtype> mean_row_;
+  // Whether the images are augmented, and with geometric augmentations,
+  // which need resampling.
+  bool augment_;
+  bool augment_geometry_;
+  // The number of crops of each input, see num_crops().
+  int num_crops_;
+  // The augmentations drawn for the current image: the map from the top
+  // coordinates, centered on the top, to the data coordinates,
+  // x = affine_[0] * u + affine_[1] * v + affine_[2] and
+  // y = affine_[3] * u + affine_[4] * v + affine_[5], then the gain of each
+  // channel and the offset added to all of them after.
+  float affine_[6];
+  vector<Dtype> gains_;
+  Dtype offset_;
 
   shared_ptr<Caffe::RNG> rng_;
   Caffe::Phase phase_;
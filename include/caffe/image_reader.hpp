@@ -0,0 +1,49 @@
+#ifndef CAFFE_IMAGE_READER_HPP_
+#define CAFFE_IMAGE_READER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Reads the bytes of image files on its own thread, in the order
+ *        they are queued, for an ImageDataLayer to decode them from memory.
+ *
+ * The layer queues the files it will need next with Read and takes them
+ * back with Pop, so that file system latency overlaps with the work of the
+ * net. Several readers fed round-robin keep several reads in flight.
+ */
+class ImageReader : public InternalThread {
+ public:
+  // Holds at most queue_size files queued or read but not popped.
+  explicit ImageReader(int queue_size);
+  virtual ~ImageReader();
+
+  // Queues filename to be read. Blocks if queue_size files are already
+  // queued or read.
+  void Read(const string& filename);
+  // Blocks until the oldest queued file is read and moves its bytes into
+  // contents. The contents are empty if the file cannot be read.
+  void Pop(string* contents);
+
+ protected:
+  virtual void InternalThreadEntry();
+
+  vector<shared_ptr<string> > buffers_;
+  // Buffers free for Read, holding a filename to read, and holding the
+  // bytes of the file read.
+  BlockingQueue<string*> free_;
+  BlockingQueue<string*> pending_;
+  BlockingQueue<string*> full_;
+
+  DISABLE_COPY_AND_ASSIGN(ImageReader);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_IMAGE_READER_HPP_
@@ -15,6 +15,7 @@ class Thread {
   Thread(Callable func, A1 a1);
   void join();
   bool joinable();
+  void interrupt();
  private:
   void* thread_;
 };
@@ -35,6 +36,12 @@ class InternalThread {
   /** Will not return until the internal thread has exited. */
   bool WaitForInternalThreadToExit();
 
+  /**
+   * Asks the internal thread to stop, interrupting it if it is blocked in
+   * a boost wait (e.g. a BlockingQueue pop), and waits for it to exit.
+   */
+  bool StopInternalThread();
+
   bool is_started() const { return thread_ != NULL && thread_->joinable(); }
 
  protected:
@@ -42,6 +49,10 @@ class InternalThread {
       with the code you want your thread to run. */
   virtual void InternalThreadEntry() {}
 
+  /* Long running InternalThreadEntry loops should test this and return
+      when it is true. Only meaningful on the internal thread. */
+  bool must_stop();
+
   caffe::Thread* thread_;
 };
 
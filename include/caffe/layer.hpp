@@ -134,7 +134,9 @@ class Layer {
    *
    * The Backward wrapper calls the relevant device wrapper function
    * (Backward_cpu or Backward_gpu) to compute the bottom blob diffs given the
-   * top blob diffs.
+   * top blob diffs. The gradients with respect to the parameter blobs are
+   * added to their diffs, so that they sum over several Backward passes
+   * until the diffs are cleared.
    *
    * Your layer should implement Forward_cpu and (optionally) Forward_gpu.
    */
@@ -269,6 +271,18 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Return whether the layer points its bottom or top blobs at memory
+   *        of its own choosing, or relies on their contents outside of its
+   *        Forward and Backward.
+   *
+   * Layers such as SplitLayer that share the memory of a blob with another,
+   * or data layers that fill their tops once or hand over their own buffers,
+   * must return true: Net memory planning then leaves the memory of their
+   * blobs alone.
+   */
+  virtual inline bool SharesBlobMemory() const { return false; }
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
@@ -713,6 +713,8 @@ class SoftmaxWithLossLayer : public LossLayer<Dtype> {
   virtual inline int ExactNumTopBlobs() const { return -1; }
   virtual inline int MinTopBlobs() const { return 1; }
   virtual inline int MaxTopBlobs() const { return 2; }
+  // The second top shares the probabilities of the layer.
+  virtual inline bool SharesBlobMemory() const { return true; }
 
  protected:
   /// @copydoc SoftmaxWithLossLayer
@@ -61,6 +61,11 @@ class Net {
    * The network backward should take no input and output, since it solely
    * computes the gradient w.r.t the parameters, and the data has already been
    * provided during the forward pass.
+   *
+   * The gradients w.r.t. the parameters are added to their diffs rather
+   * than written over them, so that the gradients of several batches can be
+   * accumulated: call ClearParamDiffs before the first Backward of each
+   * update.
    */
   void Backward();
   void BackwardFromTo(int start, int end);
@@ -85,9 +90,12 @@ class Net {
   /// @brief Updates the network weights based on the diff values computed.
   void Update();
 
-  // added for allowing large batch size
-  void AccumulateDiff();
-  void UpdateDiff();
+  /**
+   * @brief Zeroes the diffs of all the network parameters, which Backward
+   *        adds the gradients of the loss to.
+   */
+  void ClearParamDiffs();
+
   /**
    * @brief For an already initialized net, implicitly copies (i.e., using no
    *        additional memory) the pre-trained layers from another Net.
@@ -184,6 +192,18 @@ class Net {
 
   /// @brief Get misc parameters, e.g. the LR multiplier and weight decay.
   void GetLearningRateAndWeightDecay();
+  /**
+   * @brief Share the memory of the data and diffs of the blobs whose
+   *        lifetimes do not overlap.
+   *
+   * The lifetime of the data or diff of a blob spans the steps of the forward
+   * and backward passes, in the layer order, that write or read it. The
+   * lifetimes are assigned greedily, by start, to memory slabs that are free
+   * by then. The inputs and outputs of the net, the diffs holding loss
+   * weights and the blobs of layers that SharesBlobMemory() keep their own
+   * memory.
+   */
+  void PlanBlobMemory();
 
   /// @brief Individual layers in the net
   vector<shared_ptr<Layer<Dtype> > > layers_;
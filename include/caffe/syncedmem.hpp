@@ -4,6 +4,7 @@
 #include <cstdlib>
 
 #include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -21,13 +22,16 @@ namespace caffe {
 // are constantly accessing them the memory pages almost always stays in
 // the physical memory (assuming we have large enough memory installed), and
 // does not seem to create a memory bottleneck here.
+//
+// The memory comes from HostAllocator::Get(), which can cache the blocks
+// freed for reuse, align them and place them on NUMA nodes.
 
-inline void CaffeMallocHost(void** ptr, size_t size) {
-  *ptr = malloc(size);
+inline void CaffeMallocHost(void** ptr, size_t size, bool zero = false) {
+  *ptr = HostAllocator::Get().Allocate(size, zero);
 }
 
 inline void CaffeFreeHost(void* ptr) {
-  free(ptr);
+  HostAllocator::Get().Free(ptr);
 }
 
 
@@ -0,0 +1,45 @@
+#ifndef CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+#define CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+
+#include <queue>
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A thread-safe FIFO queue whose pop blocks until an element is
+ *        available. Like caffe::Thread, the boost synchronization primitives
+ *        are kept out of the header to force host compilation for boost.
+ */
+template<typename T>
+class BlockingQueue {
+ public:
+  BlockingQueue();
+
+  void push(const T& t);
+
+  bool try_pop(T* t);
+
+  // Blocks until an element is available. If it has to wait, log_on_wait is
+  // logged (when not empty) to help spotting starving consumers.
+  T pop(const string& log_on_wait = "");
+
+  // Blocks until an element is available and returns it without removing it.
+  T peek();
+
+  size_t size() const;
+
+ protected:
+  class sync;
+
+  std::queue<T> queue_;
+  shared_ptr<sync> sync_;
+
+  DISABLE_COPY_AND_ASSIGN(BlockingQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOCKING_QUEUE_HPP_
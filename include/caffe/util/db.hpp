@@ -0,0 +1,75 @@
+#ifndef CAFFE_UTIL_DB_HPP_
+#define CAFFE_UTIL_DB_HPP_
+
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe { namespace db {
+
+enum Mode { READ, WRITE, NEW };
+
+/**
+ * @brief Iterates over the records of a DB, in the order of the backend.
+ *
+ * A cursor may be used from a different thread than the one that created
+ * it, and several cursors of the same DB may be used concurrently.
+ */
+class Cursor {
+ public:
+  Cursor() { }
+  virtual ~Cursor() { }
+  virtual void SeekToFirst() = 0;
+  // Moves to the record of the given key or, if there is none, to the first
+  // record after it in key order. Backends whose records are not in key
+  // order only find the exact key, and otherwise leave the cursor invalid.
+  virtual void Seek(const string& key) = 0;
+  virtual void Next() = 0;
+  virtual string key() = 0;
+  virtual string value() = 0;
+  virtual bool valid() = 0;
+
+  DISABLE_COPY_AND_ASSIGN(Cursor);
+};
+
+/**
+ * @brief Batches writes to a DB. Nothing is written until Commit, after
+ *        which the transaction must not be used any more.
+ */
+class Transaction {
+ public:
+  Transaction() { }
+  virtual ~Transaction() { }
+  virtual void Put(const string& key, const string& value) = 0;
+  virtual void Commit() = 0;
+
+  DISABLE_COPY_AND_ASSIGN(Transaction);
+};
+
+/**
+ * @brief A key-value store holding serialized records, such as the Datums
+ *        read by DataLayer. Use GetDB to create one for a backend.
+ */
+class DB {
+ public:
+  DB() { }
+  virtual ~DB() { }
+  virtual void Open(const string& source, Mode mode) = 0;
+  virtual void Close() = 0;
+  virtual Cursor* NewCursor() = 0;
+  virtual Transaction* NewTransaction() = 0;
+  // The number of records. This walks a cursor over all of them, unless the
+  // backend keeps a count.
+  virtual int NumRecords();
+
+  DISABLE_COPY_AND_ASSIGN(DB);
+};
+
+DB* GetDB(DataParameter::DB backend);
+DB* GetDB(const string& backend);
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DB_HPP_
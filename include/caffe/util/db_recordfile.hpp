@@ -0,0 +1,105 @@
+#ifndef CAFFE_UTIL_DB_RECORDFILE_HPP_
+#define CAFFE_UTIL_DB_RECORDFILE_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "boost/thread/mutex.hpp"
+
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+class RecordFile;
+
+/**
+ * @brief Cursor over a memory-mapped RecordFile. Records come in the order
+ *        they were written.
+ */
+class RecordFileCursor : public Cursor {
+ public:
+  RecordFileCursor(RecordFile* db, const char* data,
+      const vector<uint64_t>* offsets)
+    : db_(db), data_(data), offsets_(offsets), pos_(0) { }
+  virtual void SeekToFirst() { pos_ = 0; }
+  // Moves to the record of the key, or past the last record if there is
+  // none: the records are not in key order, so there is no record after it.
+  virtual void Seek(const string& key);
+  virtual void Next() { ++pos_; }
+  virtual string key();
+  virtual string value();
+  virtual bool valid() { return pos_ < offsets_->size(); }
+
+ private:
+  RecordFile* db_;
+  const char* data_;
+  const vector<uint64_t>* offsets_;
+  size_t pos_;
+};
+
+class RecordFileTransaction : public Transaction {
+ public:
+  explicit RecordFileTransaction(RecordFile* db) : db_(db) { }
+  virtual void Put(const string& key, const string& value) {
+    records_.push_back(std::make_pair(key, value));
+  }
+  virtual void Commit();
+
+ private:
+  RecordFile* db_;
+  vector<std::pair<string, string> > records_;
+};
+
+/**
+ * @brief A single flat file of records, read through a read-only memory
+ *        mapping so cursors only touch the pages of the records they visit.
+ *
+ * The file holds the records one after the other, each as a uint32 key size,
+ * the key, a uint32 value size and the value, followed by an index of the
+ * uint64 offsets of the records and a footer made of the offset of the index,
+ * the number of records and the magic "CAFFEREC". Integers are stored in the
+ * byte order of the machine that wrote the file. Unlike LevelDB and LMDB
+ * the keys are not sorted: records are read in the order they were written.
+ * Opening in WRITE mode appends to an existing file.
+ */
+class RecordFile : public DB {
+ public:
+  RecordFile() : file_(NULL), map_(NULL), map_size_(0) { }
+  virtual ~RecordFile() { Close(); }
+  virtual void Open(const string& source, Mode mode);
+  virtual void Close();
+  virtual RecordFileCursor* NewCursor();
+  virtual RecordFileTransaction* NewTransaction();
+  // The size of the index, in READ mode.
+  virtual int NumRecords() { return offsets_.size(); }
+  // The position of the record of the key, or NumRecords() if there is none.
+  // The first call maps the keys of the file to their records, once for all
+  // the cursors. A key written more than once maps to its first record.
+  size_t Find(const string& key);
+
+ protected:
+  friend class RecordFileTransaction;
+
+  void Append(const string& key, const string& value);
+
+  string source_;
+  // WRITE and NEW
+  FILE* file_;
+  uint64_t end_;
+  // READ
+  char* map_;
+  size_t map_size_;
+  vector<uint64_t> offsets_;
+  boost::mutex positions_mutex_;
+  std::map<string, size_t> positions_;
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DB_RECORDFILE_HPP_
@@ -0,0 +1,128 @@
+#ifndef CAFFE_UTIL_FLAT_DATASET_HPP_
+#define CAFFE_UTIL_FLAT_DATASET_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief A dataset of fixed-size, already decoded images stored in a single
+ *        file that is memory-mapped for reading, so that the records are
+ *        read in place without parsing a Datum or copying them.
+ *
+ * The file starts with a 64-byte header:
+ *   char magic[8] = "CAFFEFLT"; uint32 version; uint32 data type
+ *   (0 = uint8, 1 = float); uint64 num; uint32 channels, height, width;
+ *   uint32 flags (1 = has index); uint64 labels offset; uint64 index offset
+ * followed by the num channels x height x width records, the num int32
+ * labels and, if the flags say so, an index of the num uint64 file offsets
+ * of the records. Without an index record i is at 64 + i * record size.
+ * Integers are in the byte order of the machine that wrote the file.
+ *
+ * A FlatDataset can also hold a LevelDB, LMDB or record file database loaded
+ * in memory, which is how DataLayer caches small databases.
+ */
+class FlatDataset {
+ public:
+  enum DataType { UINT8 = 0, FLOAT = 1 };
+  static const size_t kHeaderSize = 64;
+
+  FlatDataset();
+  ~FlatDataset() { Close(); }
+
+  void Open(const string& source);
+  // Reads all the Datums of a database into memory instead, decoding the
+  // encoded ones, so that they are served from RAM like a mapped file.
+  void Load(const string& source, DataParameter_DB backend);
+  void Close();
+
+  // Returns the database source loaded in memory, shared with the other
+  // callers, such as the train and test nets, as long as one of them holds
+  // it.
+  static shared_ptr<FlatDataset> LoadShared(const string& source,
+      DataParameter_DB backend);
+
+  int num() const { return num_; }
+  int channels() const { return channels_; }
+  int height() const { return height_; }
+  int width() const { return width_; }
+  DataType data_type() const { return data_type_; }
+
+  // The records point into the mapping, or the memory the records were
+  // loaded in, and live as long as the dataset is open.
+  const uint8_t* uint8_data(const int i) const {
+    DCHECK_EQ(data_type_, UINT8);
+    return reinterpret_cast<const uint8_t*>(record(i));
+  }
+  const float* float_data(const int i) const {
+    DCHECK_EQ(data_type_, FLOAT);
+    return reinterpret_cast<const float*>(record(i));
+  }
+  int label(const int i) const {
+    DCHECK_LT(i, num_);
+    return labels_[i];
+  }
+
+ protected:
+  const char* record(const int i) const {
+    DCHECK_GE(i, 0);
+    DCHECK_LT(i, num_);
+    return index_ ? map_ + index_[i] : records_ + i * record_size_;
+  }
+
+  string source_;
+  char* map_;
+  size_t map_size_;
+  // Load: the records and the labels
+  vector<char> arena_;
+  vector<int32_t> arena_labels_;
+  const char* records_;
+  int num_;
+  int channels_, height_, width_;
+  DataType data_type_;
+  size_t record_size_;
+  const int32_t* labels_;
+  const uint64_t* index_;
+
+  DISABLE_COPY_AND_ASSIGN(FlatDataset);
+};
+
+/**
+ * @brief Writes Datums of the same shape to a new FlatDataset file.
+ */
+class FlatDatasetWriter {
+ public:
+  FlatDatasetWriter() : file_(NULL) {}
+  ~FlatDatasetWriter() { Close(); }
+
+  void Open(const string& filename, FlatDataset::DataType data_type,
+      bool write_index);
+  // Appends the data() or float_data() of the datum, converted to the type
+  // of the dataset, and its label. All datums must have the same shape.
+  void Write(const Datum& datum);
+  void Close();
+
+ protected:
+  void WriteHeader();
+
+  string filename_;
+  FILE* file_;
+  FlatDataset::DataType data_type_;
+  bool write_index_;
+  int channels_, height_, width_;
+  vector<int32_t> labels_;
+  vector<float> float_buffer_;
+
+  DISABLE_COPY_AND_ASSIGN(FlatDatasetWriter);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FLAT_DATASET_HPP_
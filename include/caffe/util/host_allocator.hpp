@@ -0,0 +1,89 @@
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+#define CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+
+#include <cstddef>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A thread-safe allocator of host memory, which keeps the blocks
+ *        freed in free lists by size class and hands them out again, so
+ *        that reshaping Blob%s and building Net%s do not go to the system
+ *        allocator each time. CaffeMallocHost allocates from Get().
+ *
+ * The sizes are rounded up to a size class: a power of two, or 1.25, 1.5 or
+ * 1.75 times one, of at least 64 bytes, so that a block is less than 25%
+ * larger than asked for. With huge pages, the blocks of 2 MB or more are
+ * rounded up to a multiple of 2 MB instead. The blocks freed are only
+ * cached up to max_cached_bytes, which is 0 until set. Like ImageCache, it
+ * keeps boost out of the header.
+ *
+ * On multi-socket machines, the NUMA policy chooses the node of the pages
+ * of the blocks of 64 KB or more, such as the data of Blob%s:
+ *  - LOCAL, the default, zeroes the blocks on the allocating thread, which
+ *    places all of their pages on its node.
+ *  - FIRST_TOUCH maps blocks of zeros without touching them, so that each
+ *    page is placed on the node of the thread that first writes it, such as
+ *    the threads of the BLAS computing a layer.
+ *  - INTERLEAVE maps blocks whose pages are spread round-robin across the
+ *    nodes, so that no node serves all the threads. It requires Caffe built
+ *    with USE_NUMA, linking libnuma.
+ */
+class HostAllocator {
+ public:
+  enum NumaPolicy { LOCAL, FIRST_TOUCH, INTERLEAVE };
+
+  HostAllocator();
+  ~HostAllocator();
+
+  // The allocator of CaffeMallocHost. It is never destroyed, so that the
+  // memory of static objects can still be freed at exit.
+  static HostAllocator& Get();
+
+  // Returns a block of at least size bytes, reusing a cached one of its
+  // size class if there is one. With zero, the first size bytes are zeros.
+  void* Allocate(const size_t size, const bool zero = false);
+  // Caches the block ptr from Allocate, or releases it to the system if
+  // the cache is full or the settings changed since it was allocated.
+  void Free(void* ptr);
+  // Releases the cached blocks to the system.
+  void Trim();
+
+  // The alignment of the blocks: a power of two multiple of sizeof(void*),
+  // 64 bytes by default for cache lines and AVX loads, or 0 for that of
+  // malloc. Changing the alignment, huge pages or NUMA policy releases the
+  // cached blocks.
+  void set_alignment(const size_t alignment);
+  size_t alignment() const;
+  // Whether to align the blocks of 2 MB or more to 2 MB and advise the
+  // system to back them with transparent huge pages.
+  void set_huge_pages(const bool huge_pages);
+  bool huge_pages() const;
+  void set_numa_policy(const NumaPolicy numa_policy);
+  NumaPolicy numa_policy() const;
+  // The most bytes of free blocks to cache, 0 for none.
+  void set_max_cached_bytes(const size_t max_cached_bytes);
+  size_t max_cached_bytes() const;
+
+  // The bytes of the blocks allocated and not freed, the most of them since
+  // the allocator was created, and the bytes of the free blocks cached.
+  size_t bytes_in_use() const;
+  size_t peak_bytes_in_use() const;
+  size_t bytes_cached() const;
+
+  // The size of the blocks allocated for size bytes, without huge pages.
+  static size_t SizeClass(const size_t size);
+
+ protected:
+  class Blocks;
+
+  shared_ptr<Blocks> blocks_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HOST_ALLOCATOR_HPP_
@@ -0,0 +1,51 @@
+#ifndef CAFFE_UTIL_IMAGE_CACHE_HPP_
+#define CAFFE_UTIL_IMAGE_CACHE_HPP_
+
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace cv { class Mat; }
+
+namespace caffe {
+
+/**
+ * @brief A thread-safe cache of decoded images, holding at most capacity
+ *        bytes of pixels and evicting the least recently used images first.
+ *        The images are shared with the callers, which must not modify
+ *        them. Like BlockingQueue, it keeps boost out of the header.
+ */
+class ImageCache {
+ public:
+  explicit ImageCache(const size_t capacity);
+
+  // Returns the image of filename, reading it with cv::imread(filename,
+  // flags) if it is not cached. The image is empty if it cannot be read.
+  // Concurrent misses on the same file may each read it.
+  cv::Mat Get(const string& filename, const int flags);
+
+  // Copies the header of the image cached for key into image and returns
+  // true, or returns false if there is none.
+  bool Lookup(const string& key, cv::Mat* image);
+  // Caches image for key, evicting the least recently used images to make
+  // room. Images larger than the capacity are not cached.
+  void Insert(const string& key, const cv::Mat& image);
+
+  size_t capacity() const { return capacity_; }
+  // The bytes of pixels held.
+  size_t size() const;
+  size_t hits() const;
+  size_t misses() const;
+
+ protected:
+  class Entries;
+
+  const size_t capacity_;
+  shared_ptr<Entries> entries_;
+
+  DISABLE_COPY_AND_ASSIGN(ImageCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IMAGE_CACHE_HPP_
@@ -18,6 +18,15 @@ namespace leveldb {
 struct Options;
 }
 
+namespace boost {
+class recursive_mutex;
+}
+
+namespace cv {
+// Forward declaration for cv::Mat to be used in ReadImageToCVMat().
+class Mat;
+}
+
 namespace caffe {
 
 using ::google::protobuf::Message;
@@ -89,6 +98,16 @@ inline void WriteProtoToBinaryFile(
   WriteProtoToBinaryFile(proto, filename.c_str());
 }
 
+// Reads an image, resized to height x width unless they are 0. The image is
+// empty if it cannot be read.
+cv::Mat ReadImageToCVMat(const string& filename,
+    const int height, const int width, const bool is_color);
+
+// Decodes and resizes the image file whose bytes are in data, like
+// ReadImageToCVMat. The image is empty if it cannot be decoded.
+cv::Mat DecodeImageToCVMat(const string& data,
+    const int height, const int width, const bool is_color);
+
 bool ReadImageToDatum(const string& filename, const int label,
     const int height, const int width, const bool is_color, Datum* datum);
 
@@ -102,8 +121,44 @@ inline bool ReadImageToDatum(const string& filename, const int label,
   return ReadImageToDatum(filename, label, 0, 0, datum);
 }
 
+// Reads and resizes the image like ReadImageToDatum, then stores it encoded
+// in the given format (such as "jpg" or "png") in an encoded datum.
+bool ReadImageToDatum(const string& filename, const int label,
+    const int height, const int width, const bool is_color,
+    const string& encoding, Datum* datum);
+
+// Reads the bytes of a file into contents.
+bool ReadFileToString(const string& filename, string* contents);
+
+// Stores the bytes of an image file as they are in an encoded datum, to be
+// decoded to color or grayscale.
+bool ReadFileToDatum(const string& filename, const int label,
+    const bool is_color, Datum* datum);
+
+inline bool ReadFileToDatum(const string& filename, const int label,
+    Datum* datum) {
+  return ReadFileToDatum(filename, label, true, datum);
+}
+
+// Decodes the image of an encoded datum in place to 3 channels if is_color
+// or 1 otherwise, whatever the channels of the image, and returns false if
+// it cannot be decoded.
+bool DecodeDatum(Datum* datum, const bool is_color);
+
+// Decodes an encoded datum to the channels it was stored for: 1 if it was
+// converted as grayscale, 3 otherwise.
+inline bool DecodeDatum(Datum* datum) {
+  return DecodeDatum(datum, datum->channels() != 1);
+}
+
 leveldb::Options GetLevelDBOptions();
 
+// The HDF5 library is not thread-safe unless built to be, and is called from
+// the prefetch threads of the data layers and the writer threads of the
+// tools: every call into it holds this lock. The hdf5_ functions below take
+// it themselves; it is recursive so that their callers can hold it too.
+boost::recursive_mutex& HDF5Mutex();
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
   hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
@@ -114,6 +169,19 @@ void hdf5_load_nd_dataset(
   hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
   Blob<Dtype>* blob);
 
+// Verifies the format of a dataset like hdf5_load_nd_dataset, and returns its
+// num, channels, height and width without reading it.
+void hdf5_get_nd_dataset_shape(
+  hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+  vector<int>* shape);
+
+// Reads rows [row_begin, row_begin + num_rows) of a dataset into data. The
+// rows are selected with a hyperslab, so only they are read from the file.
+template <typename Dtype>
+void hdf5_load_nd_dataset_rows(
+  hid_t file_id, const char* dataset_name_, hsize_t row_begin,
+  hsize_t num_rows, Dtype* data);
+
 template <typename Dtype>
 void hdf5_save_nd_dataset(
   const hid_t file_id, const string dataset_name, const Blob<Dtype>& blob);
@@ -119,6 +119,9 @@ static mxArray* do_backward(const mxArray* const top_diff) {
       LOG(FATAL) << "Unknown Caffe mode.";
     }  // switch (Caffe::mode())
   }
+  // Backward accumulates the parameter diffs: clear them to return the
+  // gradients of this pass only.
+  net_->ClearParamDiffs();
   // LOG(INFO) << "Start";
   net_->Backward();
   // LOG(INFO) << "End";
@@ -307,6 +310,13 @@ static void backward(MEX_ARGS) {
   plhs[0] = do_backward(prhs[0]);
 }
 
+static void clear_param_diffs(MEX_ARGS) {
+  if (!net_) {
+    mexErrMsgTxt("Need to initialize the net first");
+  }
+  net_->ClearParamDiffs();
+}
+
 static void is_initialized(MEX_ARGS) {
   if (!net_) {
     plhs[0] = mxCreateDoubleScalar(0);
@@ -352,6 +362,7 @@ static handler_registry handlers[] = {
   // Public API functions
   { "forward",            forward         },
   { "backward",           backward        },
+  { "clear_param_diffs",  clear_param_diffs },
   { "init",               init            },
   { "is_initialized",     is_initialized  },
   { "set_mode_cpu",       set_mode_cpu    },
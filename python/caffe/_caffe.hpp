@@ -97,7 +97,13 @@ class PyNet {
       int channels, int height, int width);
 
   void Forward(int start, int end) { net_->ForwardFromTo(start, end); }
-  void Backward(int start, int end) { net_->BackwardFromTo(start, end); }
+  // Backward accumulates the parameter diffs, so they are cleared first for
+  // each call to return the gradients of that pass only.
+  void Backward(int start, int end) {
+    net_->ClearParamDiffs();
+    net_->BackwardFromTo(start, end);
+  }
+  void ClearParamDiffs() { net_->ClearParamDiffs(); }
   void Reshape() { net_->Reshape(); }
 
   void set_input_arrays(bp::object data_obj, bp::object labels_obj);
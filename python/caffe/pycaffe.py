@@ -85,7 +85,8 @@ def _Net_forward(self, blobs=None, start=None, end=None, **kwargs):
 
 def _Net_backward(self, diffs=None, start=None, end=None, **kwargs):
     """
-    Backward pass: prepare diffs and run the net backward.
+    Backward pass: prepare diffs and run the net backward. The parameter
+    diffs are zeroed first, so they hold the gradients of this pass only.
 
     Take
     diffs: list of diffs to return in addition to bottom diffs.
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
@@ -20,9 +22,7 @@ void Blob<Dtype>::Reshape(const int num, const int channels, const int height,
   if (count_ > capacity_) {
     capacity_ = count_;
     data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
-    diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
-    if (Caffe::accumulate())
-      acum_diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
+    diff_.reset();
   }
 }
 
@@ -59,26 +59,12 @@ const Dtype* Blob<Dtype>::gpu_data() const {
 
 template <typename Dtype>
 const Dtype* Blob<Dtype>::cpu_diff() const {
-  CHECK(diff_);
-  return (const Dtype*)diff_->cpu_data();
-}
-
-template <typename Dtype>
-const Dtype* Blob<Dtype>::cpu_acum_diff() const{
-  CHECK(acum_diff_);
-  return (const Dtype*)acum_diff_->cpu_data();
+  return (const Dtype*)diff()->cpu_data();
 }
 
 template <typename Dtype>
 const Dtype* Blob<Dtype>::gpu_diff() const {
-  CHECK(diff_);
-  return (const Dtype*)diff_->gpu_data();
-}
-
-template <typename Dtype>
-const Dtype* Blob<Dtype>::gpu_acum_diff() const{
-  CHECK(acum_diff_);
-  return (const Dtype*)acum_diff_->gpu_data();
+  return (const Dtype*)diff()->gpu_data();
 }
 
 template <typename Dtype>
@@ -95,26 +81,12 @@ Dtype* Blob<Dtype>::mutable_gpu_data() {
 
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_cpu_diff() {
-  CHECK(diff_);
-  return static_cast<Dtype*>(diff_->mutable_cpu_data());
-}
-
-template <typename Dtype>
-Dtype* Blob<Dtype>::mutable_cpu_acum_diff(){
-  CHECK(acum_diff_);
-  return static_cast<Dtype*>(acum_diff_->mutable_cpu_data());
+  return static_cast<Dtype*>(diff()->mutable_cpu_data());
 }
 
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_gpu_diff() {
-  CHECK(diff_);
-  return static_cast<Dtype*>(diff_->mutable_gpu_data());
-}
-
-template <typename Dtype>
-Dtype* Blob<Dtype>::mutable_gpu_acum_diff(){
-  CHECK(acum_diff_);
-  return static_cast<Dtype*>(acum_diff_->mutable_gpu_data());
+  return static_cast<Dtype*>(diff()->mutable_gpu_data());
 }
 
 template <typename Dtype>
@@ -129,6 +101,20 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::set_data(const shared_ptr<SyncedMemory>& data) {
+  CHECK_GE(data->size(), count_ * sizeof(Dtype));
+  data_ = data;
+  capacity_ = std::min<int>(capacity_, data->size() / sizeof(Dtype));
+}
+
+template <typename Dtype>
+void Blob<Dtype>::set_diff(const shared_ptr<SyncedMemory>& diff) {
+  CHECK_GE(diff->size(), count_ * sizeof(Dtype));
+  diff_ = diff;
+  capacity_ = std::min<int>(capacity_, diff->size() / sizeof(Dtype));
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
@@ -142,7 +128,7 @@ void Blob<Dtype>::Update() {
   case SyncedMemory::HEAD_AT_CPU:
     // perform computation on CPU
     caffe_axpy<Dtype>(count_, Dtype(-1),
-        static_cast<const Dtype*>(diff_->cpu_data()),
+        static_cast<const Dtype*>(diff()->cpu_data()),
         static_cast<Dtype*>(data_->mutable_cpu_data()));
     break;
   case SyncedMemory::HEAD_AT_GPU:
@@ -150,7 +136,7 @@ void Blob<Dtype>::Update() {
 #ifndef CPU_ONLY
     // perform computation on GPU
     caffe_gpu_axpy<Dtype>(count_, Dtype(-1),
-        static_cast<const Dtype*>(diff_->gpu_data()),
+        static_cast<const Dtype*>(diff()->gpu_data()),
         static_cast<Dtype*>(data_->mutable_gpu_data()));
 #else
     NO_GPU;
@@ -161,81 +147,6 @@ void Blob<Dtype>::Update() {
   }
 }
 
-// added for allowing bigger batch_size
-template <> void Blob<unsigned int>::AccumulateDiff(){
-  NOT_IMPLEMENTED;
-  return;
-}
-
-template <> void Blob<int>::AccumulateDiff(){
-  NOT_IMPLEMENTED;
-  return;
-}
-
-template <typename Dtype>
-void Blob<Dtype>::AccumulateDiff(){
-  switch (data_->head()){
-  case SyncedMemory::HEAD_AT_CPU:
-    // perform computation on CPU
-    caffe_axpy<Dtype>(count_, Dtype(1.0),
-      static_cast<const Dtype*>(diff_->cpu_data()),
-      static_cast<Dtype*>(acum_diff_->mutable_cpu_data()));
-    break;
-  case SyncedMemory::HEAD_AT_GPU:
-  case SyncedMemory::SYNCED:
-#ifndef CPU_ONLY
-    // perform computation on GPU
-    caffe_gpu_axpy<Dtype>(count_, Dtype(1.0),
-      static_cast<const Dtype*>(diff_->gpu_data()),
-      static_cast<Dtype*>(acum_diff_->mutable_gpu_data()));
-#else
-    NO_GPU;
-#endif
-    break;
-  default:
-    LOG(FATAL) << "Syncedmem not initialized.";
-  }
-}
-
-template <> void Blob<unsigned int>::UpdateDiff(){
-  NOT_IMPLEMENTED;
-  return;
-}
-
-template <> void Blob<int>::UpdateDiff(){
-  NOT_IMPLEMENTED;
-  return;
-}
-
-template <typename Dtype>
-void Blob<Dtype>::UpdateDiff(){
-  switch (data_->head()){
-  case SyncedMemory::HEAD_AT_CPU:
-    // perform computation on CPU
-    caffe_axpy<Dtype>(count_, Dtype(1.0),
-      static_cast<const Dtype*>(acum_diff_->cpu_data()),
-      static_cast<Dtype*>(diff_->mutable_cpu_data()));
-    caffe_memset(sizeof(Dtype)*count_, 0,
-      acum_diff_->mutable_cpu_data());
-    break;
-  case SyncedMemory::HEAD_AT_GPU:
-  case SyncedMemory::SYNCED:
-#ifndef CPU_ONLY
-    // perform computation on GPU
-    caffe_gpu_axpy<Dtype>(count_, Dtype(1.0),
-      static_cast<const Dtype*>(acum_diff_->gpu_data()),
-      static_cast<Dtype*>(diff_->mutable_gpu_data()));
-    caffe_gpu_memset(sizeof(Dtype)*count_, 0,
-      acum_diff_->mutable_gpu_data());
-#else
-    NO_GPU;
-#endif
-    break;
-  default:
-    LOG(FATAL) << "Syncedmem not initialized.";
-  }
-}
-
 template <> unsigned int Blob<unsigned int>::asum_data() const {
   NOT_IMPLEMENTED;
   return 0;
@@ -320,7 +231,7 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
   case Caffe::GPU:
     if (copy_diff) {
       caffe_copy(count_, source.gpu_diff(),
-          static_cast<Dtype*>(diff_->mutable_gpu_data()));
+          static_cast<Dtype*>(diff()->mutable_gpu_data()));
     } else {
       caffe_copy(count_, source.gpu_data(),
           static_cast<Dtype*>(data_->mutable_gpu_data()));
@@ -329,7 +240,7 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
   case Caffe::CPU:
     if (copy_diff) {
       caffe_copy(count_, source.cpu_diff(),
-          static_cast<Dtype*>(diff_->mutable_cpu_data()));
+          static_cast<Dtype*>(diff()->mutable_cpu_data()));
     } else {
       caffe_copy(count_, source.cpu_data(),
           static_cast<Dtype*>(data_->mutable_cpu_data()));
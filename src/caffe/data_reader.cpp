@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/data_reader.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+DataReader::DataReader(const shared_ptr<db::DB>& db, int offset, int step,
+    int skip, int queue_size, int begin, int end)
+    : db_(db), cursor_(db->NewCursor()), offset_(offset), step_(step),
+      begin_(begin), end_(end), position_(0), shuffle_window_(0),
+      next_key_(0) {
+  CHECK_GE(offset_, 0);
+  CHECK_GT(step_, offset_);
+  CHECK_GE(begin_, 0);
+  CHECK(end_ < 0 || end_ > begin_) << "Empty range of records";
+  Rewind();
+  while (skip-- > 0) {
+    NextRecord();
+  }
+  InitQueue(queue_size);
+}
+
+DataReader::DataReader(const shared_ptr<db::DB>& db, vector<string>* keys,
+    int skip, int queue_size, int shuffle_window)
+    : db_(db), cursor_(db->NewCursor()), offset_(0), step_(1), begin_(0),
+      end_(-1), position_(0), shuffle_window_(shuffle_window), next_key_(0) {
+  CHECK_GT(shuffle_window_, 0);
+  CHECK(!keys->empty()) << "The database has fewer records than readers";
+  keys_.swap(*keys);
+  for (int i = 0; i < keys_.size(); ++i) {
+    order_.push_back(i);
+  }
+  rng_.reset(new Caffe::RNG(caffe_rng_rand()));
+  ShuffleKeys();
+  next_key_ = skip % keys_.size();
+  InitQueue(queue_size);
+}
+
+void DataReader::InitQueue(int queue_size) {
+  CHECK_GT(queue_size, 0);
+  for (int i = 0; i < queue_size; ++i) {
+    buffers_.push_back(shared_ptr<string>(new string()));
+    free_.push(buffers_.back().get());
+  }
+}
+
+DataReader::~DataReader() {
+  // the thread must be stopped before its cursor is released
+  StopInternalThread();
+}
+
+const string& DataReader::Peek() {
+  return *full_.peek();
+}
+
+void DataReader::Pop(string* value) {
+  string* next = full_.pop("Waiting for data reader");
+  value->swap(*next);
+  free_.push(next);
+}
+
+void DataReader::InternalThreadEntry() {
+  while (shuffle_window_ > 0 && !must_stop()) {
+    ReadShuffledWindow();
+  }
+  while (shuffle_window_ == 0 && !must_stop()) {
+    string* value = free_.pop();
+    *value = cursor_->value();
+    NextRecord();
+    full_.push(value);
+  }
+}
+
+void DataReader::Rewind() {
+  if (!first_key_.empty()) {
+    cursor_->Seek(first_key_);
+    CHECK(cursor_->valid() && cursor_->key() == first_key_)
+        << "Record " << first_key_ << " disappeared from the database";
+    position_ = begin_ + offset_;
+    return;
+  }
+  cursor_->SeekToFirst();
+  position_ = 0;
+  CHECK(cursor_->valid()) << "Empty database";
+  for (int i = 0; i < begin_ + offset_; ++i) {
+    CHECK(Step()) << "The database has fewer records than readers";
+  }
+  // Later rewinds seek to the first record instead of walking to it again.
+  if (position_ > 0) {
+    first_key_ = cursor_->key();
+  }
+}
+
+void DataReader::NextRecord() {
+  for (int i = 0; i < step_; ++i) {
+    if (!Step()) {
+      // We have reached the end. Restart from the first.
+      DLOG(INFO) << "Restarting data prefetching from start.";
+      Rewind();
+      return;
+    }
+  }
+}
+
+bool DataReader::Step() {
+  cursor_->Next();
+  ++position_;
+  return cursor_->valid() && (end_ < 0 || position_ < end_);
+}
+
+void DataReader::ReadShuffledWindow() {
+  if (next_key_ == order_.size()) {
+    // Start a new epoch in a new order.
+    ShuffleKeys();
+    next_key_ = 0;
+  }
+  const int window_size =
+      std::min<int>(shuffle_window_, order_.size() - next_key_);
+  // Read the window sorted by the keys' position in the database, keeping
+  // the position of each record in the window.
+  window_.resize(window_size);
+  for (int i = 0; i < window_size; ++i) {
+    window_[i] = std::make_pair(order_[next_key_ + i], i);
+  }
+  std::sort(window_.begin(), window_.end());
+  window_values_.resize(window_size);
+  for (int i = 0; i < window_size; ++i) {
+    const string& key = keys_[window_[i].first];
+    cursor_->Seek(key);
+    CHECK(cursor_->valid() && cursor_->key() == key)
+        << "Record " << key << " disappeared from the database";
+    window_values_[window_[i].second] = cursor_->value();
+  }
+  next_key_ += window_size;
+  for (int i = 0; i < window_size; ++i) {
+    string* value = free_.pop();
+    value->swap(window_values_[i]);
+    full_.push(value);
+  }
+}
+
+void DataReader::ShuffleKeys() {
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(rng_->generator());
+  shuffle(order_.begin(), order_.end(), rng);
+}
+
+}  // namespace caffe
@@ -1,34 +1,268 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
 #include <string>
 
+#include "opencv2/core/core.hpp"
+
 #include "caffe/data_transformer.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
 
+// The row kernels of TransformData: top_row[i] = (row[i] - mean_row[i]) *
+// scale over n pixels, stored reversed when mirrored. The generic versions
+// are plain loops on contiguous rows that the compiler can vectorize; the
+// common case of bytes transformed to floats is written with SSE2.
+template <typename T, typename Dtype>
+static inline void TransformRow(const T* row, const Dtype* mean_row,
+    const Dtype scale, const int n, Dtype* top_row) {
+  for (int i = 0; i < n; ++i) {
+    top_row[i] = (static_cast<Dtype>(row[i]) - mean_row[i]) * scale;
+  }
+}
+
+template <typename T, typename Dtype>
+static inline void TransformRowMirrored(const T* row, const Dtype* mean_row,
+    const Dtype scale, const int n, Dtype* top_row) {
+  for (int i = 0; i < n; ++i) {
+    top_row[n - 1 - i] = (static_cast<Dtype>(row[i]) - mean_row[i]) * scale;
+  }
+}
+
+#ifdef __SSE2__
+// Widens 16 bytes to 4 vectors of 4 floats and applies the mean and scale.
+static inline void TransformBytes(const uint8_t* row, const float* mean_row,
+    const __m128 scale, __m128* top) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bytes =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+  const __m128i low = _mm_unpacklo_epi8(bytes, zero);
+  const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+  const __m128i words[4] = {
+    _mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+    _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero)
+  };
+  for (int k = 0; k < 4; ++k) {
+    const __m128 pixels = _mm_cvtepi32_ps(words[k]);
+    top[k] = _mm_mul_ps(_mm_sub_ps(pixels, _mm_loadu_ps(mean_row + 4 * k)),
+        scale);
+  }
+}
+
+template <>
+inline void TransformRow(const uint8_t* row, const float* mean_row,
+    const float scale, const int n, float* top_row) {
+  const __m128 scale4 = _mm_set1_ps(scale);
+  __m128 top[4];
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    TransformBytes(row + i, mean_row + i, scale4, top);
+    for (int k = 0; k < 4; ++k) {
+      _mm_storeu_ps(top_row + i + 4 * k, top[k]);
+    }
+  }
+  for (; i < n; ++i) {
+    top_row[i] = (static_cast<float>(row[i]) - mean_row[i]) * scale;
+  }
+}
+
+template <>
+inline void TransformRowMirrored(const uint8_t* row, const float* mean_row,
+    const float scale, const int n, float* top_row) {
+  const __m128 scale4 = _mm_set1_ps(scale);
+  __m128 top[4];
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    TransformBytes(row + i, mean_row + i, scale4, top);
+    // Pixels i + 4k to i + 4k + 3 go reversed to n - i - 4k - 4 and up.
+    for (int k = 0; k < 4; ++k) {
+      _mm_storeu_ps(top_row + n - i - 4 * k - 4,
+          _mm_shuffle_ps(top[k], top[k], _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+  }
+  for (; i < n; ++i) {
+    top_row[n - 1 - i] = (static_cast<float>(row[i]) - mean_row[i]) * scale;
+  }
+}
+#endif  // __SSE2__
+
+// The kernels for rows whose pixels are pixel_step elements apart, such as
+// the rows of one channel of an image with interleaved channels.
+template <typename T, typename Dtype>
+static inline void TransformRow(const T* row, const int pixel_step,
+    const Dtype* mean_row, const Dtype scale, const int n, Dtype* top_row) {
+  for (int i = 0; i < n; ++i) {
+    top_row[i] =
+        (static_cast<Dtype>(row[i * pixel_step]) - mean_row[i]) * scale;
+  }
+}
+
+template <typename T, typename Dtype>
+static inline void TransformRowMirrored(const T* row, const int pixel_step,
+    const Dtype* mean_row, const Dtype scale, const int n, Dtype* top_row) {
+  for (int i = 0; i < n; ++i) {
+    top_row[n - 1 - i] =
+        (static_cast<Dtype>(row[i * pixel_step]) - mean_row[i]) * scale;
+  }
+}
+
+template<typename Dtype>
+DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param)
+    : param_(param) {
+  phase_ = Caffe::phase();
+  for (int c = 0; c < param_.mean_value_size(); ++c) {
+    mean_values_.push_back(param_.mean_value(c));
+  }
+  CHECK_GT(param_.min_scale(), 0);
+  CHECK_LE(param_.min_scale(), param_.max_scale());
+  CHECK_GE(param_.max_aspect_ratio(), 1);
+  augment_geometry_ = param_.min_scale() != 1 || param_.max_scale() != 1 ||
+      param_.max_aspect_ratio() != 1 || param_.max_rotation() != 0;
+  // The gains must stay positive, see TransformCrop.
+  CHECK_GE(param_.contrast(), 0);
+  CHECK_LT(param_.contrast(), 1);
+  CHECK_GE(param_.color(), 0);
+  CHECK_LT(param_.color(), 1);
+  // Augmentations only apply while training.
+  augment_ = phase_ == Caffe::TRAIN && (augment_geometry_ ||
+      param_.brightness() != 0 || param_.contrast() != 0 ||
+      param_.color() != 0);
+  if (!augment_) {
+    augment_geometry_ = false;
+  }
+  // Multiple crops only apply while testing.
+  const int test_crops = param_.test_crops();
+  CHECK(test_crops == 1 || test_crops == 5 || test_crops == 10)
+      << "test_crops must be 1, 5 or 10";
+  num_crops_ = phase_ == Caffe::TEST ? test_crops : 1;
+  if (num_crops_ > 1) {
+    CHECK_GT(param_.crop_size(), 0) << "test_crops requires a crop_size";
+  }
+}
+
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const int batch_item_id,
                                        const Datum& datum,
                                        const Dtype* mean,
                                        Dtype* transformed_data) {
+  // we will prefer to use data() first, and then try float_data()
   const string& data = datum.data();
-  const int channels = datum.channels();
-  const int height = datum.height();
-  const int width = datum.width();
-  const int size = datum.channels() * datum.height() * datum.width();
+  if (data.size()) {
+    TransformData(batch_item_id, reinterpret_cast<const uint8_t*>(data.data()),
+        datum.channels(), datum.height(), datum.width(),
+        datum.height() * datum.width(), datum.width(), 1, mean,
+        transformed_data);
+  } else {
+    TransformData(batch_item_id, datum.float_data().data(),
+        datum.channels(), datum.height(), datum.width(),
+        datum.height() * datum.width(), datum.width(), 1, mean,
+        transformed_data);
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const int batch_item_id,
+                                       const uint8_t* data,
+                                       const int channels, const int height,
+                                       const int width, const Dtype* mean,
+                                       Dtype* transformed_data) {
+  TransformData(batch_item_id, data, channels, height, width,
+      height * width, width, 1, mean, transformed_data);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const int batch_item_id,
+                                       const float* data,
+                                       const int channels, const int height,
+                                       const int width, const Dtype* mean,
+                                       Dtype* transformed_data) {
+  TransformData(batch_item_id, data, channels, height, width,
+      height * width, width, 1, mean, transformed_data);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const int batch_item_id,
+                                       const cv::Mat& cv_img,
+                                       const Dtype* mean,
+                                       Dtype* transformed_data) {
+  CHECK_EQ(cv_img.depth(), CV_8U) << "Only 8-bit images can be transformed";
+  const int channels = cv_img.channels();
+  TransformData(batch_item_id, cv_img.ptr<uint8_t>(0), channels,
+      cv_img.rows, cv_img.cols, 1, static_cast<int>(cv_img.step), channels,
+      mean, transformed_data);
+}
 
+template<typename Dtype> template <typename T>
+void DataTransformer<Dtype>::TransformData(const int batch_item_id,
+                                           const T* data,
+                                           const int channels,
+                                           const int height,
+                                           const int width,
+                                           const int channel_step,
+                                           const int row_step,
+                                           const int pixel_step,
+                                           const Dtype* mean,
+                                           Dtype* transformed_data) {
   const int crop_size = param_.crop_size();
   const bool mirror = param_.mirror();
-  const Dtype scale = param_.scale();
 
   if (mirror && crop_size == 0) {
     LOG(FATAL) << "Current implementation requires mirror and crop_size to be "
                << "set at the same time.";
   }
+  const bool has_mean_values = mean_values_.size() > 0;
+  if (has_mean_values) {
+    CHECK(mean_values_.size() == 1 || mean_values_.size() == channels)
+        << "Specify either 1 mean_value or as many as channels: " << channels;
+  }
+
+  if (augment_) {
+    const int top_height = crop_size ? crop_size : height;
+    const int top_width = crop_size ? crop_size : width;
+    DrawAugmentation(channels, height, width, top_height, top_width);
+    if (augment_geometry_) {
+      TransformAugmented(batch_item_id, data, channels, height, width,
+          channel_step, row_step, pixel_step, top_height, top_width, mean,
+          transformed_data);
+    } else {
+      // The crop lies on whole pixels, so it goes through the row kernels.
+      const int h_off = static_cast<int>(
+          floor(affine_[5] - (top_height - 1) / 2.f + 0.5f));
+      const int w_off = static_cast<int>(
+          floor(affine_[2] - (top_width - 1) / 2.f + 0.5f));
+      TransformCrop(batch_item_id, data, channels, height, width,
+          channel_step, row_step, pixel_step, h_off, w_off, top_height,
+          top_width, affine_[0] < 0, true, mean, transformed_data);
+    }
+    return;
+  }
+
+  if (num_crops_ > 1) {
+    // The center, the 4 corners, then the mirrors of these 5.
+    const int h_offs[5] = { (height - crop_size) / 2, 0, 0,
+                            height - crop_size, height - crop_size };
+    const int w_offs[5] = { (width - crop_size) / 2, 0, width - crop_size,
+                            0, width - crop_size };
+    for (int i = 0; i < num_crops_; ++i) {
+      TransformCrop(batch_item_id * num_crops_ + i, data, channels, height,
+          width, channel_step, row_step, pixel_step, h_offs[i % 5],
+          w_offs[i % 5], crop_size, crop_size, i >= 5, false, mean,
+          transformed_data);
+    }
+    return;
+  }
 
+  int h_off = 0;
+  int w_off = 0;
+  int top_height = height;
+  int top_width = width;
+  bool do_mirror = false;
   if (crop_size) {
-    CHECK(data.size()) << "Image cropping only support uint8 data";
-    int h_off, w_off;
     // We only do random crop when we do training.
     if (phase_ == Caffe::TRAIN) {
       h_off = Rand() % (height - crop_size);
@@ -37,50 +271,206 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
       h_off = (height - crop_size) / 2;
       w_off = (width - crop_size) / 2;
     }
-    if (mirror && Rand() % 2) {
-      // Copy mirrored version
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            int data_index = (c * height + h + h_off) * width + w + w_off;
-            int top_index = ((batch_item_id * channels + c) * crop_size + h)
-                * crop_size + (crop_size - 1 - w);
-            Dtype datum_element =
-                static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-            transformed_data[top_index] =
-                (datum_element - mean[data_index]) * scale;
-          }
+    do_mirror = mirror && Rand() % 2;
+    top_height = crop_size;
+    top_width = crop_size;
+  }
+  TransformCrop(batch_item_id, data, channels, height, width, channel_step,
+      row_step, pixel_step, h_off, w_off, top_height, top_width, do_mirror,
+      false, mean, transformed_data);
+}
+
+template<typename Dtype> template <typename T>
+void DataTransformer<Dtype>::TransformCrop(const int top_item_id,
+    const T* data, const int channels, const int height, const int width,
+    const int channel_step, const int row_step, const int pixel_step,
+    const int h_off, const int w_off, const int top_height,
+    const int top_width, const bool do_mirror, const bool photometric,
+    const Dtype* mean, Dtype* transformed_data) {
+  const bool has_mean_values = mean_values_.size() > 0;
+  Dtype* top_data =
+      transformed_data + top_item_id * channels * top_height * top_width;
+  if (has_mean_values || photometric) {
+    mean_row_.resize(top_width);
+  }
+  for (int c = 0; c < channels; ++c) {
+    // The photometric augmentations fold into the kernels:
+    // (x * gain + offset - mean) * scale is
+    // (x - (mean - offset) / gain) * gain * scale.
+    Dtype scale = param_.scale();
+    Dtype gain = 1;
+    Dtype offset = 0;
+    if (photometric) {
+      gain = gains_[c];
+      offset = offset_;
+      scale *= gain;
+    }
+    // With mean values, every row subtracts the same row of the channel mean.
+    if (has_mean_values) {
+      std::fill(mean_row_.begin(), mean_row_.end(),
+          (mean_values_[mean_values_.size() == 1 ? 0 : c] - offset) / gain);
+    }
+    for (int h = 0; h < top_height; ++h) {
+      const T* row = data + c * channel_step + (h + h_off) * row_step +
+          w_off * pixel_step;
+      // The mean image is stored channel by channel whatever the data layout.
+      const int mean_index = (c * height + h + h_off) * width + w_off;
+      const Dtype* mean_row =
+          has_mean_values ? &mean_row_[0] : mean + mean_index;
+      if (photometric && !has_mean_values) {
+        for (int i = 0; i < top_width; ++i) {
+          mean_row_[i] = (mean_row[i] - offset) / gain;
         }
+        mean_row = &mean_row_[0];
       }
-    } else {
-      // Normal copy
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            int top_index = ((batch_item_id * channels + c) * crop_size + h)
-                * crop_size + w;
-            int data_index = (c * height + h + h_off) * width + w + w_off;
-            Dtype datum_element =
-                static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-            transformed_data[top_index] =
-                (datum_element - mean[data_index]) * scale;
-          }
+      Dtype* top_row = top_data + (c * top_height + h) * top_width;
+      if (pixel_step == 1) {
+        if (do_mirror) {
+          TransformRowMirrored(row, mean_row, scale, top_width, top_row);
+        } else {
+          TransformRow(row, mean_row, scale, top_width, top_row);
+        }
+      } else {
+        if (do_mirror) {
+          TransformRowMirrored(row, pixel_step, mean_row, scale, top_width,
+              top_row);
+        } else {
+          TransformRow(row, pixel_step, mean_row, scale, top_width, top_row);
         }
       }
     }
+  }
+}
+
+template <typename Dtype>
+void DataTransformer<Dtype>::DrawAugmentation(const int channels,
+    const int height, const int width, const int top_height,
+    const int top_width) {
+  // The geometric augmentations compose into the linear part of the map,
+  // in data pixels per top pixel.
+  float linear[4] = {1, 0, 0, 1};
+  if (augment_geometry_) {
+    const float zoom = RandUniform(param_.min_scale(), param_.max_scale());
+    const float log_aspect_ratio = log(param_.max_aspect_ratio());
+    const float aspect_ratio =
+        exp(RandUniform(-log_aspect_ratio, log_aspect_ratio));
+    const float angle =
+        RandUniform(-param_.max_rotation(), param_.max_rotation()) * M_PI /
+        180;
+    const float scale_x = 1 / (zoom * sqrt(aspect_ratio));
+    const float scale_y = sqrt(aspect_ratio) / zoom;
+    linear[0] = cos(angle) * scale_x;
+    linear[1] = -sin(angle) * scale_y;
+    linear[2] = sin(angle) * scale_x;
+    linear[3] = cos(angle) * scale_y;
+  }
+  if (param_.mirror() && Rand() % 2) {
+    linear[0] = -linear[0];
+    linear[2] = -linear[2];
+  }
+  // Place the crop at random where it fits in the image, or at the center.
+  // Without geometric augmentations, it is placed on whole pixels so that
+  // no resampling happens.
+  const float top_half_width = (top_width - 1) / 2.f;
+  const float top_half_height = (top_height - 1) / 2.f;
+  float center_x = (width - 1) / 2.f;
+  float center_y = (height - 1) / 2.f;
+  if (augment_geometry_) {
+    const float extent_x = fabs(linear[0]) * top_half_width +
+        fabs(linear[1]) * top_half_height;
+    const float extent_y = fabs(linear[2]) * top_half_width +
+        fabs(linear[3]) * top_half_height;
+    if (extent_x < center_x) {
+      center_x = RandUniform(extent_x, width - 1 - extent_x);
+    }
+    if (extent_y < center_y) {
+      center_y = RandUniform(extent_y, height - 1 - extent_y);
+    }
   } else {
-    // we will prefer to use data() first, and then try float_data()
-    if (data.size()) {
-      for (int j = 0; j < size; ++j) {
-        Dtype datum_element =
-            static_cast<Dtype>(static_cast<uint8_t>(data[j]));
-        transformed_data[j + batch_item_id * size] =
-            (datum_element - mean[j]) * scale;
+    center_x = Rand() % (width - top_width + 1) + top_half_width;
+    center_y = Rand() % (height - top_height + 1) + top_half_height;
+  }
+  affine_[0] = linear[0];
+  affine_[1] = linear[1];
+  affine_[2] = center_x;
+  affine_[3] = linear[2];
+  affine_[4] = linear[3];
+  affine_[5] = center_y;
+
+  // The photometric augmentations compose into a gain per channel and an
+  // offset.
+  offset_ = RandUniform(-param_.brightness(), param_.brightness());
+  const float contrast =
+      RandUniform(1 - param_.contrast(), 1 + param_.contrast());
+  gains_.resize(channels);
+  for (int c = 0; c < channels; ++c) {
+    gains_[c] = contrast * RandUniform(1 - param_.color(), 1 + param_.color());
+  }
+}
+
+template<typename Dtype> template <typename T>
+void DataTransformer<Dtype>::TransformAugmented(const int batch_item_id,
+    const T* data, const int channels, const int height, const int width,
+    const int channel_step, const int row_step, const int pixel_step,
+    const int top_height, const int top_width, const Dtype* mean,
+    Dtype* transformed_data) {
+  const Dtype scale = param_.scale();
+  const bool has_mean_values = mean_values_.size() > 0;
+  const int top_size = top_height * top_width;
+  Dtype* top_data = transformed_data + batch_item_id * channels * top_size;
+  for (int h = 0; h < top_height; ++h) {
+    const float v = h - (top_height - 1) / 2.f;
+    for (int w = 0; w < top_width; ++w) {
+      const float u = w - (top_width - 1) / 2.f;
+      const float x = affine_[0] * u + affine_[1] * v + affine_[2];
+      const float y = affine_[3] * u + affine_[4] * v + affine_[5];
+      // Interpolate bilinearly between the 4 pixels around (x, y), the ones
+      // out of the image counting as the mean, so 0 once it is subtracted.
+      // The mean image is interpolated the same way, so that each pixel is
+      // centered on its own mean, and the mean values and the brightness
+      // are weighted by the coverage of the pixels in the image.
+      const int x0 = static_cast<int>(floor(x));
+      const int y0 = static_cast<int>(floor(y));
+      const float fx = x - x0;
+      const float fy = y - y0;
+      const float weights[4] = {
+        (1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy
+      };
+      int offsets[4];
+      int mean_offsets[4];
+      int num_pixels = 0;
+      float pixel_weights[4];
+      float coverage = 0;
+      for (int k = 0; k < 4; ++k) {
+        const int px = x0 + (k & 1);
+        const int py = y0 + (k >> 1);
+        if (weights[k] != 0 && px >= 0 && px < width && py >= 0 &&
+            py < height) {
+          offsets[num_pixels] = py * row_step + px * pixel_step;
+          mean_offsets[num_pixels] = py * width + px;
+          pixel_weights[num_pixels] = weights[k];
+          coverage += weights[k];
+          ++num_pixels;
+        }
       }
-    } else {
-      for (int j = 0; j < size; ++j) {
-        transformed_data[j + batch_item_id * size] =
-            (datum.float_data(j) - mean[j]) * scale;
+      for (int c = 0; c < channels; ++c) {
+        const T* channel_data = data + c * channel_step;
+        float pixel = 0;
+        for (int k = 0; k < num_pixels; ++k) {
+          pixel += pixel_weights[k] * channel_data[offsets[k]];
+        }
+        float channel_mean = 0;
+        if (has_mean_values) {
+          channel_mean =
+              mean_values_[mean_values_.size() == 1 ? 0 : c] * coverage;
+        } else {
+          const Dtype* mean_channel = mean + c * height * width;
+          for (int k = 0; k < num_pixels; ++k) {
+            channel_mean += pixel_weights[k] * mean_channel[mean_offsets[k]];
+          }
+        }
+        top_data[c * top_size + h * top_width + w] =
+            (pixel * gains_[c] + offset_ * coverage - channel_mean) * scale;
       }
     }
   }
@@ -89,7 +479,7 @@ void DataTransformer<Dtype>::Transform(const int batch_item_id,
 template <typename Dtype>
 void DataTransformer<Dtype>::InitRand() {
   const bool needs_rand = (phase_ == Caffe::TRAIN) &&
-      (param_.mirror() || param_.crop_size());
+      (param_.mirror() || param_.crop_size() || augment_);
   if (needs_rand) {
     const unsigned int rng_seed = caffe_rng_rand();
     rng_.reset(new Caffe::RNG(rng_seed));
@@ -106,6 +496,11 @@ unsigned int DataTransformer<Dtype>::Rand() {
   return (*rng)();
 }
 
+template <typename Dtype>
+float DataTransformer<Dtype>::RandUniform(const float min, const float max) {
+  return min + (max - min) * (Rand() / 4294967296.);
+}
+
 INSTANTIATE_CLASS(DataTransformer);
 
 }  // namespace caffe
@@ -0,0 +1,44 @@
+#include <string>
+
+#include "caffe/image_reader.hpp"
+#include "caffe/util/io.hpp"
+
+namespace caffe {
+
+ImageReader::ImageReader(int queue_size) {
+  CHECK_GT(queue_size, 0);
+  for (int i = 0; i < queue_size; ++i) {
+    buffers_.push_back(shared_ptr<string>(new string()));
+    free_.push(buffers_.back().get());
+  }
+}
+
+ImageReader::~ImageReader() {
+  StopInternalThread();
+}
+
+void ImageReader::Read(const string& filename) {
+  string* buffer = free_.pop();
+  *buffer = filename;
+  pending_.push(buffer);
+}
+
+void ImageReader::Pop(string* contents) {
+  string* buffer = full_.pop("Waiting for image reader");
+  contents->swap(*buffer);
+  free_.push(buffer);
+}
+
+void ImageReader::InternalThreadEntry() {
+  string contents;
+  while (!must_stop()) {
+    string* buffer = pending_.pop();
+    if (!ReadFileToString(*buffer, &contents)) {
+      contents.clear();
+    }
+    buffer->swap(contents);
+    full_.push(buffer);
+  }
+}
+
+}  // namespace caffe
@@ -1,3 +1,6 @@
+#include <stdint.h>
+
+#include <boost/thread.hpp>
 #include <string>
 #include <vector>
 
@@ -6,6 +9,32 @@
 
 namespace caffe {
 
+void GetShardRange(int num, int shard_id, int num_shards, int* begin,
+    int* end) {
+  CHECK_GE(num_shards, 1);
+  CHECK_LT(shard_id, num_shards) << "shard_id must be less than num_shards";
+  *begin = static_cast<int64_t>(num) * shard_id / num_shards;
+  *end = static_cast<int64_t>(num) * (shard_id + 1) / num_shards;
+}
+
+void GetShardRecords(int num, int shard_id, int num_shards,
+    DataParameter::ShardMode mode, vector<int>* records) {
+  int begin, end;
+  GetShardRange(num, shard_id, num_shards, &begin, &end);
+  records->clear();
+  if (mode == DataParameter_ShardMode_RANGE) {
+    for (int i = begin; i < end; ++i) {
+      records->push_back(i);
+    }
+  } else {
+    for (int i = shard_id; i < num; i += num_shards) {
+      records->push_back(i);
+    }
+  }
+  CHECK(!records->empty()) << "Shard " << shard_id << " of " << num_shards
+      << " of " << num << " records is empty";
+}
+
 template <typename Dtype>
 BaseDataLayer<Dtype>::BaseDataLayer(const LayerParameter& param)
     : Layer<Dtype>(param),
@@ -31,6 +60,13 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_GE(datum_width_, transform_param_.crop_size());
   }
   // check if we want to have mean
+  CHECK(!(transform_param_.has_mean_file() &&
+          transform_param_.mean_value_size() > 0))
+      << "Specify either a mean_file or mean_values, not both";
+  if (transform_param_.mean_value_size() > 1) {
+    CHECK_EQ(transform_param_.mean_value_size(), datum_channels_)
+        << "Specify either 1 mean_value or as many as channels";
+  }
   if (transform_param_.has_mean_file()) {
     const string& mean_file = transform_param_.mean_file();
     LOG(INFO) << "Loading mean file from" << mean_file;
@@ -49,49 +85,177 @@ void BaseDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   data_transformer_.InitRand();
 }
 
+template <typename Dtype>
+BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
+    const LayerParameter& param)
+    : BaseDataLayer<Dtype>(param),
+      prefetch_(param.data_param().prefetch()), current_batch_(NULL),
+      slice_batch_size_(0), slice_data_(NULL), slice_label_(NULL) {
+  CHECK_GE(prefetch_.size(), 1) << "Need at least one prefetch batch";
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i].reset(new Batch<Dtype>());
+    prefetch_free_.push(prefetch_[i].get());
+  }
+}
+
+template <typename Dtype>
+BasePrefetchingDataLayer<Dtype>::~BasePrefetchingDataLayer() {
+  // The subclasses have stopped the prefetch thread, so no slice is pending.
+  for (int i = 0; i < prefetch_workers_.size(); ++i) {
+    pending_slices_.push(-1);
+  }
+  prefetch_workers_.clear();
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  // Setting up the layer again starts over with fresh batches.
+  if (is_started()) {
+    ResetPrefetch();
+  }
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
-  // Now, start the prefetch thread. Before calling prefetch, we make two
+  const int num_slices = this->transform_param_.threads();
+  CHECK_GE(num_slices, 1) << "A prefetching data layer needs at least 1 thread";
+  for (int i = 1; i < num_slices; ++i) {
+    slice_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(this->transform_param_)));
+    prefetch_workers_.push_back(
+        shared_ptr<PrefetchWorker>(new PrefetchWorker(this)));
+    CHECK(prefetch_workers_.back()->StartInternalThread())
+        << "Prefetch worker execution failed";
+  }
+  // Now, start the prefetch thread. Before calling prefetch, we make
   // cpu_data calls so that the prefetch thread does not accidentally make
   // simultaneous cudaMalloc calls when the main thread is running. In some
   // GPUs this seems to cause failures if we do not so.
-  this->prefetch_data_.mutable_cpu_data();
-  if (this->output_labels_) {
-    this->prefetch_label_.mutable_cpu_data();
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i]->data_.mutable_cpu_data();
+    if (this->output_labels_) {
+      prefetch_[i]->label_.mutable_cpu_data();
+    }
   }
   DLOG(INFO) << "Initializing prefetch";
   this->CreatePrefetchThread();
   DLOG(INFO) << "Prefetch initialized.";
 }
 
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::ResetPrefetch() {
+  StopPrefetchThread();
+  for (int i = 0; i < prefetch_workers_.size(); ++i) {
+    pending_slices_.push(-1);
+  }
+  prefetch_workers_.clear();
+  slice_transformers_.clear();
+  // The thread may have been stopped with a batch in hand, so requeue them
+  // all rather than the queued ones.
+  Batch<Dtype>* batch;
+  while (prefetch_full_.try_pop(&batch)) {}
+  while (prefetch_free_.try_pop(&batch)) {}
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_free_.push(prefetch_[i].get());
+  }
+  current_batch_ = NULL;
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::CreatePrefetchThread() {
   this->phase_ = Caffe::phase();
   this->data_transformer_.InitRand();
+  for (int i = 0; i < slice_transformers_.size(); ++i) {
+    slice_transformers_[i]->InitRand();
+  }
   CHECK(StartInternalThread()) << "Thread execution failed";
 }
 
 template <typename Dtype>
-void BasePrefetchingDataLayer<Dtype>::JoinPrefetchThread() {
-  CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+void BasePrefetchingDataLayer<Dtype>::StopPrefetchThread() {
+  CHECK(StopInternalThread()) << "Thread joining failed";
 }
 
 template <typename Dtype>
-void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
-    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
-  // First, join the thread
-  JoinPrefetchThread();
-  // Copy the data
-  caffe_copy(prefetch_data_.count(), prefetch_data_.cpu_data(),
-             (*top)[0]->mutable_cpu_data());
+void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
+  while (!must_stop()) {
+    Batch<Dtype>* batch = prefetch_free_.pop();
+    LoadBatch(batch);
+    prefetch_full_.push(batch);
+  }
+}
+
+template <typename Dtype>
+DataTransformer<Dtype>* BasePrefetchingDataLayer<Dtype>::slice_transformer(
+    const int slice_id) {
+  if (slice_id == 0) {
+    return &this->data_transformer_;
+  }
+  return slice_transformers_[slice_id - 1].get();
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::FillBatchInParallel(
+    Batch<Dtype>* batch) {
+  // The workers read the subclass state, so the prefetch thread must not be
+  // stopped while they are busy.
+  boost::this_thread::disable_interruption no_interruption;
+  // Get the pointers here so that the workers never touch the SyncedMemory
+  // state concurrently. The slices split the inputs, each of which the
+  // transformers turn into num_crops items.
+  slice_batch_size_ = batch->data_.num() /
+      this->data_transformer_.num_crops();
+  slice_data_ = batch->data_.mutable_cpu_data();
+  slice_label_ = NULL;
   if (this->output_labels_) {
-    caffe_copy(prefetch_label_.count(), prefetch_label_.cpu_data(),
-               (*top)[1]->mutable_cpu_data());
+    slice_label_ = batch->label_.mutable_cpu_data();
   }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
+  for (int i = 1; i <= prefetch_workers_.size(); ++i) {
+    pending_slices_.push(i);
+  }
+  FillSlice(0);
+  for (int i = 0; i < prefetch_workers_.size(); ++i) {
+    filled_slices_.pop();
+  }
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::FillSlice(const int slice_id) {
+  const int num_slices = prefetch_workers_.size() + 1;
+  FillBatchSlice(slice_id, slice_batch_size_ * slice_id / num_slices,
+      slice_batch_size_ * (slice_id + 1) / num_slices, slice_data_,
+      slice_label_);
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::RunPrefetchWorker() {
+  for (int slice_id = pending_slices_.pop(); slice_id >= 0;
+       slice_id = pending_slices_.pop()) {
+    FillSlice(slice_id);
+    filled_slices_.push(slice_id);
+  }
+}
+
+template <typename Dtype>
+Batch<Dtype>* BasePrefetchingDataLayer<Dtype>::ShareNextBatch(
+    vector<Blob<Dtype>*>* top) {
+  // The net is done with the previous batch once Forward is called again.
+  if (current_batch_) {
+    prefetch_free_.push(current_batch_);
+  }
+  current_batch_ = prefetch_full_.pop("Data layer prefetch queue empty");
+  // Share the batch with the top blobs instead of copying it.
+  (*top)[0]->ReshapeLike(current_batch_->data_);
+  (*top)[0]->ShareData(current_batch_->data_);
+  if (this->output_labels_) {
+    (*top)[1]->ReshapeLike(current_batch_->label_);
+    (*top)[1]->ShareData(current_batch_->label_);
+  }
+  return current_batch_;
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  ShareNextBatch(top);
 }
 
 #ifdef CPU_ONLY
@@ -0,0 +1,72 @@
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void CropAverageLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  num_crops_ = this->layer_param_.crop_average_param().num_crops();
+  CHECK_GT(num_crops_, 0) << "num_crops must be positive";
+}
+
+template <typename Dtype>
+void CropAverageLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  for (int i = 0; i < bottom.size(); ++i) {
+    CHECK_EQ(bottom[i]->num() % num_crops_, 0)
+        << "The num " << bottom[i]->num() << " of bottom " << i
+        << " is not a multiple of num_crops " << num_crops_ << ": the data "
+        << "layer must set the same test_crops, which only apply to nets "
+        << "built in the TEST phase";
+    (*top)[i]->Reshape(bottom[i]->num() / num_crops_, bottom[i]->channels(),
+        bottom[i]->height(), bottom[i]->width());
+  }
+}
+
+template <typename Dtype>
+void CropAverageLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const Dtype weight = Dtype(1) / num_crops_;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = (*top)[i]->mutable_cpu_data();
+    const int dim = bottom[i]->count() / bottom[i]->num();
+    caffe_set((*top)[i]->count(), Dtype(0), top_data);
+    for (int n = 0; n < (*top)[i]->num(); ++n) {
+      for (int k = 0; k < num_crops_; ++k) {
+        caffe_axpy(dim, weight, bottom_data + (n * num_crops_ + k) * dim,
+            top_data + n * dim);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void CropAverageLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  const Dtype weight = Dtype(1) / num_crops_;
+  for (int i = 0; i < top.size(); ++i) {
+    if (!propagate_down[i]) { continue; }
+    const Dtype* top_diff = top[i]->cpu_diff();
+    Dtype* bottom_diff = (*bottom)[i]->mutable_cpu_diff();
+    const int dim = top[i]->count() / top[i]->num();
+    for (int n = 0; n < top[i]->num(); ++n) {
+      for (int k = 0; k < num_crops_; ++k) {
+        caffe_cpu_scale(dim, weight, top_diff + n * dim,
+            bottom_diff + (n * num_crops_ + k) * dim);
+      }
+    }
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(CropAverageLayer);
+#endif
+
+INSTANTIATE_CLASS(CropAverageLayer);
+
+}  // namespace caffe
@@ -0,0 +1,73 @@
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// One thread per top element, summing the num_crops items it averages.
+template <typename Dtype>
+__global__ void CropAverageForward(const int n, const Dtype* in,
+    const int num_crops, const int dim, const Dtype weight, Dtype* out) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int item = index / dim;
+    const int d = index % dim;
+    const Dtype* crops = in + item * num_crops * dim + d;
+    Dtype sum = 0;
+    for (int k = 0; k < num_crops; ++k) {
+      sum += crops[k * dim];
+    }
+    out[index] = sum * weight;
+  }
+}
+
+template <typename Dtype>
+void CropAverageLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  const Dtype weight = Dtype(1) / num_crops_;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->gpu_data();
+    Dtype* top_data = (*top)[i]->mutable_gpu_data();
+    const int dim = bottom[i]->count() / bottom[i]->num();
+    const int count = (*top)[i]->count();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    CropAverageForward<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, bottom_data, num_crops_, dim, weight,
+        top_data);
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+// One thread per bottom element, taking its share of the top diff.
+template <typename Dtype>
+__global__ void CropAverageBackward(const int n, const Dtype* in_diff,
+    const int num_crops, const int dim, const Dtype weight,
+    Dtype* out_diff) {
+  CUDA_KERNEL_LOOP(index, n) {
+    const int item = index / (num_crops * dim);
+    const int d = index % dim;
+    out_diff[index] = in_diff[item * dim + d] * weight;
+  }
+}
+
+template <typename Dtype>
+void CropAverageLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, vector<Blob<Dtype>*>* bottom) {
+  const Dtype weight = Dtype(1) / num_crops_;
+  for (int i = 0; i < top.size(); ++i) {
+    if (!propagate_down[i]) { continue; }
+    const Dtype* top_diff = top[i]->gpu_diff();
+    Dtype* bottom_diff = (*bottom)[i]->mutable_gpu_diff();
+    const int dim = top[i]->count() / top[i]->num();
+    const int count = (*bottom)[i]->count();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    CropAverageBackward<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, top_diff, num_crops_, dim, weight,
+        bottom_diff);
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+INSTANTIATE_CLASS(CropAverageLayer);
+
+}  // namespace caffe
@@ -1,13 +1,15 @@
-#include <leveldb/db.h>
 #include <stdint.h>
 
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "caffe/common.hpp"
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/flat_dataset.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -16,123 +18,153 @@ namespace caffe {
 
 template <typename Dtype>
 DataLayer<Dtype>::~DataLayer<Dtype>() {
-  this->JoinPrefetchThread();
-  // clean up the database resources
-  switch (this->layer_param_.data_param().backend()) {
-  case DataParameter_DB_LEVELDB:
-    break;  // do nothing
-  case DataParameter_DB_LMDB:
-    mdb_cursor_close(mdb_cursor_);
-    mdb_close(mdb_env_, mdb_dbi_);
-    mdb_txn_abort(mdb_txn_);
-    mdb_env_close(mdb_env_);
-    break;
-  default:
-    LOG(FATAL) << "Unknown database backend";
-  }
+  this->StopPrefetchThread();
 }
 
 template <typename Dtype>
 void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
-  // Initialize DB
-  switch (this->layer_param_.data_param().backend()) {
-  case DataParameter_DB_LEVELDB:
-    {
-    leveldb::DB* db_temp;
-    leveldb::Options options = GetLevelDBOptions();
-    options.create_if_missing = false;
-    LOG(INFO) << "Opening leveldb " << this->layer_param_.data_param().source();
-    leveldb::Status status = leveldb::DB::Open(
-        options, this->layer_param_.data_param().source(), &db_temp);
-    CHECK(status.ok()) << "Failed to open leveldb "
-                       << this->layer_param_.data_param().source() << std::endl
-                       << status.ToString();
-    db_.reset(db_temp);
-    iter_.reset(db_->NewIterator(leveldb::ReadOptions()));
-    iter_->SeekToFirst();
-    }
-    break;
-  case DataParameter_DB_LMDB:
-    CHECK_EQ(mdb_env_create(&mdb_env_), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(mdb_env_, 1099511627776), MDB_SUCCESS);  // 1TB
-    CHECK_EQ(mdb_env_open(mdb_env_,
-             this->layer_param_.data_param().source().c_str(),
-             MDB_RDONLY|MDB_NOTLS, 0664), MDB_SUCCESS) << "mdb_env_open failed";
-    CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, MDB_RDONLY, &mdb_txn_), MDB_SUCCESS)
-        << "mdb_txn_begin failed";
-    CHECK_EQ(mdb_open(mdb_txn_, NULL, 0, &mdb_dbi_), MDB_SUCCESS)
-        << "mdb_open failed";
-    CHECK_EQ(mdb_cursor_open(mdb_txn_, mdb_dbi_, &mdb_cursor_), MDB_SUCCESS)
-        << "mdb_cursor_open failed";
-    LOG(INFO) << "Opening lmdb " << this->layer_param_.data_param().source();
-    CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_FIRST),
-        MDB_SUCCESS) << "mdb_cursor_get failed";
-    break;
-  default:
-    LOG(FATAL) << "Unknown database backend";
+  const DataParameter& data_param = this->layer_param_.data_param();
+  vector<string> sources(1, data_param.source());
+  sources.insert(sources.end(), data_param.shard_source().begin(),
+      data_param.shard_source().end());
+  const int readers_per_source = data_param.readers_per_source();
+  CHECK_GE(readers_per_source, 1);
+  const int shard_id = data_param.shard_id();
+  const int num_shards = data_param.num_shards();
+  CHECK_GE(num_shards, 1);
+  CHECK_LT(shard_id, num_shards) << "shard_id must be less than num_shards";
+  if (num_shards > 1) {
+    LOG(INFO) << "Reading shard " << shard_id << " of " << num_shards;
   }
+  const int num_readers = sources.size() * readers_per_source;
+  // Let each reader get its share of a batch ahead.
+  const int queue_size =
+      (data_param.batch_size() + num_readers - 1) / num_readers;
 
   // Check if we would need to randomly skip a few data points
-  if (this->layer_param_.data_param().rand_skip()) {
-    unsigned int skip = caffe_rng_rand() %
-                        this->layer_param_.data_param().rand_skip();
+  unsigned int skip = 0;
+  if (data_param.rand_skip()) {
+    skip = caffe_rng_rand() % data_param.rand_skip();
     LOG(INFO) << "Skipping first " << skip << " data points.";
-    while (skip-- > 0) {
-      switch (this->layer_param_.data_param().backend()) {
-      case DataParameter_DB_LEVELDB:
-        iter_->Next();
-        if (!iter_->Valid()) {
-          iter_->SeekToFirst();
-        }
-        break;
-      case DataParameter_DB_LMDB:
-        if (mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_NEXT)
-            != MDB_SUCCESS) {
-          CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
-                   MDB_FIRST), MDB_SUCCESS);
+  }
+  Datum datum;
+  if (data_param.backend() == DataParameter_DB_FLAT ||
+      data_param.cache_in_memory()) {
+    // Map the datasets, or load the databases in memory; the records are
+    // read in place by FillBatchSlice.
+    for (int i = 0; i < sources.size(); ++i) {
+      if (data_param.backend() == DataParameter_DB_FLAT) {
+        flat_datasets_.push_back(shared_ptr<FlatDataset>(new FlatDataset()));
+        flat_datasets_[i]->Open(sources[i]);
+      } else {
+        flat_datasets_.push_back(
+            FlatDataset::LoadShared(sources[i], data_param.backend()));
+      }
+      CHECK_GT(flat_datasets_[i]->num(), 0) << "Empty flat dataset "
+          << sources[i];
+      flat_orders_.push_back(vector<int>());
+      GetShardRecords(flat_datasets_[i]->num(), shard_id, num_shards,
+          data_param.shard_mode(), &flat_orders_[i]);
+      flat_positions_.push_back(skip % flat_orders_[i].size());
+      CHECK_EQ(flat_datasets_[i]->channels(), flat_datasets_[0]->channels());
+      CHECK_EQ(flat_datasets_[i]->height(), flat_datasets_[0]->height());
+      CHECK_EQ(flat_datasets_[i]->width(), flat_datasets_[0]->width());
+    }
+    if (data_param.shuffle()) {
+      const unsigned int rng_seed = caffe_rng_rand();
+      flat_rng_.reset(new Caffe::RNG(rng_seed));
+      for (int i = 0; i < flat_orders_.size(); ++i) {
+        ShuffleFlatDataset(i);
+      }
+    }
+    datum.set_channels(flat_datasets_[0]->channels());
+    datum.set_height(flat_datasets_[0]->height());
+    datum.set_width(flat_datasets_[0]->width());
+  } else {
+    // Initialize DB
+    for (int i = 0; i < sources.size(); ++i) {
+      shared_ptr<db::DB> db(db::GetDB(data_param.backend()));
+      db->Open(sources[i], db::READ);
+      // Shuffled readers read the records of their keys, indexed here by a
+      // single walk of the database for all of them.
+      vector<string> keys;
+      if (data_param.shuffle()) {
+        ReadKeys(db.get(), &keys);
+      }
+      // A stride split interleaves the readers of the shards: reader j of
+      // shard s reads records s + num_shards * j, each
+      // num_shards * readers_per_source records.
+      int begin = 0, end = -1, offset = 0, step = 1;
+      if (data_param.shard_mode() == DataParameter_ShardMode_RANGE) {
+        const int num_records =
+            data_param.shuffle() ? keys.size() : db->NumRecords();
+        GetShardRange(num_records, shard_id, num_shards, &begin, &end);
+        CHECK_LT(begin, end) << "Shard " << shard_id << " of " << sources[i]
+            << " is empty";
+      } else {
+        offset = shard_id;
+        step = num_shards;
+      }
+      for (int j = 0; j < readers_per_source; ++j) {
+        // As with flat datasets, the skip counts records of the shard of
+        // the source, which reader j holds one of every readers_per_source
+        // of. Skipping whole records of the reader keeps the readers, and
+        // the shards, disjoint.
+        const int reader_skip =
+            (skip + readers_per_source - 1 - j) / readers_per_source;
+        if (data_param.shuffle()) {
+          const int reader_end = end < 0 ? keys.size() : end;
+          vector<string> reader_keys;
+          for (int k = begin + offset + step * j; k < reader_end;
+               k += step * readers_per_source) {
+            reader_keys.push_back(keys[k]);
+          }
+          readers_.push_back(shared_ptr<DataReader>(
+              new DataReader(db, &reader_keys, reader_skip, queue_size,
+                  data_param.shuffle_window())));
+        } else {
+          readers_.push_back(shared_ptr<DataReader>(
+              new DataReader(db, offset + step * j,
+                  step * readers_per_source, reader_skip, queue_size, begin,
+                  end)));
         }
-        break;
-      default:
-        LOG(FATAL) << "Unknown database backend";
+        CHECK(readers_.back()->StartInternalThread())
+            << "Data reader execution failed";
       }
     }
-  }
-  // Read a data point, and use it to initialize the top blob.
-  Datum datum;
-  switch (this->layer_param_.data_param().backend()) {
-  case DataParameter_DB_LEVELDB:
-    datum.ParseFromString(iter_->value().ToString());
-    break;
-  case DataParameter_DB_LMDB:
-    datum.ParseFromArray(mdb_value_.mv_data, mdb_value_.mv_size);
-    break;
-  default:
-    LOG(FATAL) << "Unknown database backend";
+    LOG(INFO) << "Reading " << sources.size() << " database(s) with "
+        << num_readers << " reader(s)";
+
+    // Read a data point, and use it to initialize the top blob.
+    datum.ParseFromString(readers_[0]->Peek());
+    if (datum.encoded()) {
+      CHECK(DecodeDatum(&datum)) << "Could not decode the first datum";
+    }
   }
 
-  // image
+  // image, each one making num_crops items of the batch
   int crop_size = this->layer_param_.transform_param().crop_size();
+  const int num_crops = this->data_transformer_.num_crops();
+  const int top_num = this->layer_param_.data_param().batch_size() * num_crops;
   if (crop_size > 0) {
-    (*top)[0]->Reshape(this->layer_param_.data_param().batch_size(),
-                       datum.channels(), crop_size, crop_size);
-    this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-        datum.channels(), crop_size, crop_size);
+    (*top)[0]->Reshape(top_num, datum.channels(), crop_size, crop_size);
   } else {
-    (*top)[0]->Reshape(
-        this->layer_param_.data_param().batch_size(), datum.channels(),
-        datum.height(), datum.width());
-    this->prefetch_data_.Reshape(this->layer_param_.data_param().batch_size(),
-        datum.channels(), datum.height(), datum.width());
+    (*top)[0]->Reshape(top_num, datum.channels(), datum.height(),
+        datum.width());
+  }
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.ReshapeLike(*(*top)[0]);
   }
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
       << (*top)[0]->width();
   // label
   if (this->output_labels_) {
-    (*top)[1]->Reshape(this->layer_param_.data_param().batch_size(), 1, 1, 1);
-    this->prefetch_label_.Reshape(this->layer_param_.data_param().batch_size(),
-        1, 1, 1);
+    (*top)[1]->Reshape(top_num, 1, 1, 1);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->label_.ReshapeLike(*(*top)[1]);
+    }
   }
   // datum size
   this->datum_channels_ = datum.channels();
@@ -141,64 +173,101 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   this->datum_size_ = datum.channels() * datum.height() * datum.width();
 }
 
-// This function is used to create a thread that prefetches the data.
+// This function is called on the prefetch thread.
 template <typename Dtype>
-void DataLayer<Dtype>::InternalThreadEntry() {
-  Datum datum;
-  CHECK(this->prefetch_data_.count());
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
-  Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
-  if (this->output_labels_) {
-    top_label = this->prefetch_label_.mutable_cpu_data();
-  }
+void DataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CHECK(batch->data_.count());
   const int batch_size = this->layer_param_.data_param().batch_size();
 
-  for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
-    switch (this->layer_param_.data_param().backend()) {
-    case DataParameter_DB_LEVELDB:
-      CHECK(iter_);
-      CHECK(iter_->Valid());
-      datum.ParseFromString(iter_->value().ToString());
-      break;
-    case DataParameter_DB_LMDB:
-      CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
-              &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
-      datum.ParseFromArray(mdb_value_.mv_data,
-          mdb_value_.mv_size);
-      break;
-    default:
-      LOG(FATAL) << "Unknown database backend";
+  // Take the records from the readers, or the flat datasets, in turn and
+  // leave the parsing and transformation to FillBatchSlice.
+  if (flat_datasets_.size()) {
+    prefetch_records_.resize(batch_size);
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      const int i = next_reader_;
+      const int position = flat_positions_[i];
+      prefetch_records_[item_id] = std::make_pair(i, flat_orders_[i][position]);
+      flat_positions_[i] = (position + 1) % flat_orders_[i].size();
+      if (flat_positions_[i] == 0 && flat_rng_) {
+        ShuffleFlatDataset(i);
+      }
+      next_reader_ = (next_reader_ + 1) % flat_datasets_.size();
+    }
+  } else {
+    prefetch_values_.resize(batch_size);
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      readers_[next_reader_]->Pop(&prefetch_values_[item_id]);
+      next_reader_ = (next_reader_ + 1) % readers_.size();
+    }
+  }
+  this->FillBatchInParallel(batch);
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::FillBatchSlice(const int slice_id, const int item_begin,
+    const int item_end, Dtype* top_data, Dtype* top_label) {
+  DataTransformer<Dtype>* transformer = this->slice_transformer(slice_id);
+  if (flat_datasets_.size()) {
+    FillFlatBatchSlice(transformer, item_begin, item_end, top_data, top_label);
+    return;
+  }
+  Datum datum;
+  for (int item_id = item_begin; item_id < item_end; ++item_id) {
+    datum.ParseFromString(prefetch_values_[item_id]);
+    if (datum.encoded()) {
+      // Decoding is the costly step, and runs on every prefetch worker. The
+      // images are decoded to the channels of the first one.
+      CHECK(DecodeDatum(&datum, this->datum_channels_ != 1))
+          << "Could not decode datum";
+      CHECK_EQ(datum.channels() * datum.height() * datum.width(),
+          this->datum_size_) << "Encoded images must all have the same size";
     }
 
     // Apply data transformations (mirror, scale, crop...)
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
+    transformer->Transform(item_id, datum, this->mean_, top_data);
 
     if (this->output_labels_) {
-      top_label[item_id] = datum.label();
+      this->SetLabel(item_id, datum.label(), transformer->num_crops(),
+          top_label);
     }
+  }
+}
 
-    // go to the next iter
-    switch (this->layer_param_.data_param().backend()) {
-    case DataParameter_DB_LEVELDB:
-      iter_->Next();
-      if (!iter_->Valid()) {
-        // We have reached the end. Restart from the first.
-        DLOG(INFO) << "Restarting data prefetching from start.";
-        iter_->SeekToFirst();
-      }
-      break;
-    case DataParameter_DB_LMDB:
-      if (mdb_cursor_get(mdb_cursor_, &mdb_key_,
-              &mdb_value_, MDB_NEXT) != MDB_SUCCESS) {
-        // We have reached the end. Restart from the first.
-        DLOG(INFO) << "Restarting data prefetching from start.";
-        CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
-                &mdb_value_, MDB_FIRST), MDB_SUCCESS);
-      }
-      break;
-    default:
-      LOG(FATAL) << "Unknown database backend";
+template <typename Dtype>
+void DataLayer<Dtype>::ReadKeys(db::DB* db, vector<string>* keys) {
+  boost::scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  for (cursor->SeekToFirst(); cursor->valid(); cursor->Next()) {
+    keys->push_back(cursor->key());
+  }
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::ShuffleFlatDataset(const int i) {
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(flat_rng_->generator());
+  shuffle(flat_orders_[i].begin(), flat_orders_[i].end(), rng);
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::FillFlatBatchSlice(DataTransformer<Dtype>* transformer,
+    const int item_begin, const int item_end, Dtype* top_data,
+    Dtype* top_label) {
+  for (int item_id = item_begin; item_id < item_end; ++item_id) {
+    const FlatDataset& dataset =
+        *flat_datasets_[prefetch_records_[item_id].first];
+    const int record = prefetch_records_[item_id].second;
+    // Transform straight from the mapped record.
+    if (dataset.data_type() == FlatDataset::UINT8) {
+      transformer->Transform(item_id, dataset.uint8_data(record),
+          dataset.channels(), dataset.height(), dataset.width(), this->mean_,
+          top_data);
+    } else {
+      transformer->Transform(item_id, dataset.float_data(record),
+          dataset.channels(), dataset.height(), dataset.width(), this->mean_,
+          top_data);
+    }
+    if (this->output_labels_) {
+      this->SetLabel(item_id, dataset.label(record), transformer->num_crops(),
+          top_label);
     }
   }
 }
@@ -1,59 +1,80 @@
-/*
-TODO:
-- load file in a separate thread ("prefetch")
-- can be smarter about the memcpy call instead of doing it row-by-row
-  :: use util functions caffe_copy, and Blob->offset()
-  :: don't forget to update hdf5_daa_layer.cu accordingly
-- add ability to shuffle filenames if flag is set
-*/
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
 
+#include "boost/thread/recursive_mutex.hpp"
 #include "hdf5.h"
 #include "hdf5_hl.h"
 #include "stdint.h"
 
+#include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
-#include "caffe/vision_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
 template <typename Dtype>
-HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() { }
+HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() {
+  this->StopPrefetchThread();
+  CloseHDF5File();
+}
 
-// Load data and label from HDF5 filename into the class property blobs.
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename) {
-  LOG(INFO) << "Loading HDF5 file" << filename;
-  hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-  if (file_id < 0) {
-    LOG(ERROR) << "Failed opening HDF5 file" << filename;
-    return;
-  }
+void HDF5DataLayer<Dtype>::OpenHDF5File(const char* filename) {
+  LOG(INFO) << "Loading HDF5 file " << filename;
+  boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
+  file_id_ = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+  CHECK_GE(file_id_, 0) << "Failed opening HDF5 file " << filename;
 
   const int MIN_DATA_DIM = 2;
   const int MAX_DATA_DIM = 4;
-  hdf5_load_nd_dataset(
-    file_id, "data",  MIN_DATA_DIM, MAX_DATA_DIM, &data_blob_);
+  vector<int> data_shape;
+  hdf5_get_nd_dataset_shape(file_id_, HDF5_DATA_DATASET_NAME,
+      MIN_DATA_DIM, MAX_DATA_DIM, &data_shape);
 
   const int MIN_LABEL_DIM = 1;
   const int MAX_LABEL_DIM = 2;
-  hdf5_load_nd_dataset(
-    file_id, "label", MIN_LABEL_DIM, MAX_LABEL_DIM, &label_blob_);
+  vector<int> label_shape;
+  hdf5_get_nd_dataset_shape(file_id_, HDF5_DATA_LABEL_NAME,
+      MIN_LABEL_DIM, MAX_LABEL_DIM, &label_shape);
+
+  CHECK_EQ(data_shape[0], label_shape[0]);
+  CHECK_GT(data_shape[0], 0) << "No rows in HDF5 file " << filename;
+  file_rows_ = data_shape[0];
+  // No row is buffered yet; LoadHDF5Chunk reads them.
+  data_blob_.Reshape(0, data_shape[1], data_shape[2], data_shape[3]);
+  label_blob_.Reshape(0, label_shape[1], label_shape[2], label_shape[3]);
+  chunk_row_ = 0;
+  LOG(INFO) << "Streaming " << file_rows_ << " rows";
+}
 
-  herr_t status = H5Fclose(file_id);
-  CHECK_GE(status, 0) << "Failed to close HDF5 file " << filename;
-  CHECK_EQ(data_blob_.num(), label_blob_.num());
-  LOG(INFO) << "Successully loaded " << data_blob_.num() << " rows";
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::CloseHDF5File() {
+  if (file_id_ >= 0) {
+    boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
+    herr_t status = H5Fclose(file_id_);
+    CHECK_GE(status, 0) << "Failed to close HDF5 file";
+    file_id_ = -1;
+  }
 }
 
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+void HDF5DataLayer<Dtype>::ShuffleFiles() {
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(shuffle_rng_->generator());
+  shuffle(file_permutation_.begin(), file_permutation_.end(), rng);
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  CloseHDF5File();
   // Read the source to parse the filenames.
-  const string& source = this->layer_param_.hdf5_data_param().source();
+  const HDF5DataParameter& hdf5_data_param =
+      this->layer_param_.hdf5_data_param();
+  const string& source = hdf5_data_param.source();
   LOG(INFO) << "Loading filename from " << source;
   hdf_filenames_.clear();
   std::ifstream source_file(source.c_str());
@@ -65,54 +86,110 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   source_file.close();
   num_files_ = hdf_filenames_.size();
-  current_file_ = 0;
+  CHECK_GE(num_files_, 1) << "No HDF5 file listed in " << source;
   LOG(INFO) << "Number of files: " << num_files_;
+  CHECK_GT(hdf5_data_param.chunk_size(), 0) << "chunk_size must be positive";
 
-  // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
+  file_permutation_.clear();
+  for (unsigned int i = 0; i < num_files_; ++i) {
+    file_permutation_.push_back(i);
+  }
+  if (hdf5_data_param.shuffle()) {
+    const unsigned int rng_seed = caffe_rng_rand();
+    shuffle_rng_.reset(new Caffe::RNG(rng_seed));
+    ShuffleFiles();
+  }
+
+  // Open the first HDF5 file and initialize the line counter.
+  current_file_ = 0;
+  OpenHDF5File(hdf_filenames_[file_permutation_[current_file_]].c_str());
   current_row_ = 0;
 
   // Reshape blobs.
-  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
+  const int batch_size = hdf5_data_param.batch_size();
   (*top)[0]->Reshape(batch_size, data_blob_.channels(),
                      data_blob_.height(), data_blob_.width());
   (*top)[1]->Reshape(batch_size, label_blob_.channels(),
                      label_blob_.height(), label_blob_.width());
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.ReshapeLike(*(*top)[0]);
+    this->prefetch_[i]->label_.ReshapeLike(*(*top)[1]);
+  }
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
       << (*top)[0]->width();
+  this->datum_channels_ = data_blob_.channels();
+  this->datum_height_ = data_blob_.height();
+  this->datum_width_ = data_blob_.width();
+  this->datum_size_ = this->datum_channels_ * this->datum_height_ *
+      this->datum_width_;
 }
 
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      vector<Blob<Dtype>*>* top) {
-  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  const int data_count = (*top)[0]->count() / (*top)[0]->num();
-  const int label_data_count = (*top)[1]->count() / (*top)[1]->num();
-
-  for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == data_blob_.num()) {
-      if (num_files_ > 1) {
-        current_file_ += 1;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          LOG(INFO) << "looping around to first file";
-        }
-        LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
+void HDF5DataLayer<Dtype>::LoadHDF5Chunk() {
+  if (current_row_ == file_rows_) {
+    current_file_ += 1;
+    if (current_file_ == num_files_) {
+      current_file_ = 0;
+      LOG(INFO) << "looping around to first file";
+      if (this->layer_param_.hdf5_data_param().shuffle()) {
+        ShuffleFiles();
       }
-      current_row_ = 0;
     }
-    caffe_copy(data_count, &data_blob_.cpu_data()[current_row_ * data_count],
-               &(*top)[0]->mutable_cpu_data()[i * data_count]);
-    caffe_copy(label_data_count,
-               &label_blob_.cpu_data()[current_row_ * label_data_count],
-               &(*top)[1]->mutable_cpu_data()[i * label_data_count]);
+    if (num_files_ > 1) {
+      CloseHDF5File();
+      OpenHDF5File(hdf_filenames_[file_permutation_[current_file_]].c_str());
+    }
+    current_row_ = 0;
   }
+  const hsize_t rows = std::min<hsize_t>(
+      this->layer_param_.hdf5_data_param().chunk_size(),
+      file_rows_ - current_row_);
+  data_blob_.Reshape(rows, data_blob_.channels(), data_blob_.height(),
+      data_blob_.width());
+  label_blob_.Reshape(rows, label_blob_.channels(), label_blob_.height(),
+      label_blob_.width());
+  {
+    boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
+    hdf5_load_nd_dataset_rows(file_id_, HDF5_DATA_DATASET_NAME, current_row_,
+        rows, data_blob_.mutable_cpu_data());
+    hdf5_load_nd_dataset_rows(file_id_, HDF5_DATA_LABEL_NAME, current_row_,
+        rows, label_blob_.mutable_cpu_data());
+  }
+  current_row_ += rows;
+  chunk_row_ = 0;
 }
 
-#ifdef CPU_ONLY
-STUB_GPU_FORWARD(HDF5DataLayer, Forward);
-#endif
+// Called on the prefetch thread.
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  const int batch_size = batch->data_.num();
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = batch->label_.mutable_cpu_data();
+  int item = 0;
+  while (item < batch_size) {
+    if (chunk_row_ == data_blob_.num()) {
+      LoadHDF5Chunk();
+      CHECK_EQ(data_blob_.count() / data_blob_.num(),
+          batch->data_.count() / batch_size)
+          << "The data of all the HDF5 files must have the same shape";
+      CHECK_EQ(label_blob_.count() / label_blob_.num(),
+          batch->label_.count() / batch_size)
+          << "The labels of all the HDF5 files must have the same shape";
+    }
+    // Copy as many consecutive rows of the chunk as the batch takes at once.
+    const int rows = std::min(batch_size - item,
+        data_blob_.num() - chunk_row_);
+    caffe_copy(rows * data_blob_.count() / data_blob_.num(),
+        data_blob_.cpu_data() + data_blob_.offset(chunk_row_),
+        top_data + batch->data_.offset(item));
+    caffe_copy(rows * label_blob_.count() / label_blob_.num(),
+        label_blob_.cpu_data() + label_blob_.offset(chunk_row_),
+        top_label + batch->label_.offset(item));
+    item += rows;
+    chunk_row_ += rows;
+  }
+}
 
 INSTANTIATE_CLASS(HDF5DataLayer);
 
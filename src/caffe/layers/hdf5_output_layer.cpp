@@ -1,5 +1,6 @@
 #include <vector>
 
+#include "boost/thread/recursive_mutex.hpp"
 #include "hdf5.h"
 #include "hdf5_hl.h"
 
@@ -16,6 +17,7 @@ HDF5OutputLayer<Dtype>::HDF5OutputLayer(const LayerParameter& param)
     : Layer<Dtype>(param),
       file_name_(param.hdf5_output_param().file_name()) {
   /* create a HDF5 file */
+  boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
   file_id_ = H5Fcreate(file_name_.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
                        H5P_DEFAULT);
   CHECK_GE(file_id_, 0) << "Failed to open HDF5 file" << file_name_;
@@ -23,6 +25,7 @@ HDF5OutputLayer<Dtype>::HDF5OutputLayer(const LayerParameter& param)
 
 template <typename Dtype>
 HDF5OutputLayer<Dtype>::~HDF5OutputLayer<Dtype>() {
+  boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
   herr_t status = H5Fclose(file_id_);
   CHECK_GE(status, 0) << "Failed to close HDF5 file " << file_name_;
 }
@@ -33,6 +36,8 @@ void HDF5OutputLayer<Dtype>::SaveBlobs() {
   LOG(INFO) << "Saving HDF5 file" << file_name_;
   CHECK_EQ(data_blob_.num(), label_blob_.num()) <<
       "data blob and label blob must have the same batch size";
+  // Writes both datasets under one lock.
+  boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
   hdf5_save_nd_dataset(file_id_, HDF5_DATA_DATASET_NAME, data_blob_);
   hdf5_save_nd_dataset(file_id_, HDF5_DATA_LABEL_NAME, label_blob_);
   LOG(INFO) << "Successfully saved " << data_blob_.num() << " rows";
@@ -4,6 +4,8 @@
 #include <utility>
 #include <vector>
 
+#include "opencv2/core/core.hpp"
+
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
@@ -14,7 +16,7 @@ namespace caffe {
 
 template <typename Dtype>
 ImageDataLayer<Dtype>::~ImageDataLayer<Dtype>() {
-  this->JoinPrefetchThread();
+  this->StopPrefetchThread();
 }
 
 template <typename Dtype>
@@ -31,9 +33,25 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   std::ifstream infile(source.c_str());
   string filename;
   int label;
+  lines_.clear();
   while (infile >> filename >> label) {
     lines_.push_back(std::make_pair(filename, label));
   }
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  if (image_data_param.num_shards() != 1 || image_data_param.shard_id() != 0) {
+    // Keep the lines of this shard, in the order of the source.
+    vector<int> records;
+    GetShardRecords(lines_.size(), image_data_param.shard_id(),
+        image_data_param.num_shards(), image_data_param.shard_mode(),
+        &records);
+    for (int i = 0; i < records.size(); ++i) {
+      lines_[i] = lines_[records[i]];
+    }
+    lines_.resize(records.size());
+    LOG(INFO) << "Reading shard " << image_data_param.shard_id() << " of "
+        << image_data_param.num_shards();
+  }
 
   if (this->layer_param_.image_data_param().shuffle()) {
     // randomly shuffle data
@@ -53,34 +71,61 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_GT(lines_.size(), skip) << "Not enough points to skip";
     lines_id_ = skip;
   }
-  // Read a data point, and use it to initialize the top blob.
-  Datum datum;
-  CHECK(ReadImageToDatum(lines_[lines_id_].first, lines_[lines_id_].second,
-                         new_height, new_width, &datum));
+  // Read an image, and use it to initialize the top blob.
+  cv::Mat cv_img = ReadImageToCVMat(lines_[lines_id_].first,
+                                    new_height, new_width, true);
+  CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
   // image
   const int crop_size = this->layer_param_.transform_param().crop_size();
-  const int batch_size = this->layer_param_.image_data_param().batch_size();
+  // Each image makes num_crops items of the batch.
+  const int top_num = this->layer_param_.image_data_param().batch_size() *
+      this->data_transformer_.num_crops();
   if (crop_size > 0) {
-    (*top)[0]->Reshape(batch_size, datum.channels(), crop_size, crop_size);
-    this->prefetch_data_.Reshape(batch_size, datum.channels(), crop_size,
-                                 crop_size);
+    (*top)[0]->Reshape(top_num, cv_img.channels(), crop_size, crop_size);
   } else {
-    (*top)[0]->Reshape(batch_size, datum.channels(), datum.height(),
-                       datum.width());
-    this->prefetch_data_.Reshape(batch_size, datum.channels(), datum.height(),
-        datum.width());
+    (*top)[0]->Reshape(top_num, cv_img.channels(), cv_img.rows,
+                       cv_img.cols);
+  }
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.ReshapeLike(*(*top)[0]);
   }
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
       << (*top)[0]->width();
   // label
-  (*top)[1]->Reshape(batch_size, 1, 1, 1);
-  this->prefetch_label_.Reshape(batch_size, 1, 1, 1);
+  (*top)[1]->Reshape(top_num, 1, 1, 1);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->label_.ReshapeLike(*(*top)[1]);
+  }
   // datum size
-  this->datum_channels_ = datum.channels();
-  this->datum_height_ = datum.height();
-  this->datum_width_ = datum.width();
-  this->datum_size_ = datum.channels() * datum.height() * datum.width();
+  this->datum_channels_ = cv_img.channels();
+  this->datum_height_ = cv_img.rows;
+  this->datum_width_ = cv_img.cols;
+  this->datum_size_ = cv_img.channels() * cv_img.rows * cv_img.cols;
+
+  // Start reading the files of the first batches.
+  readers_.clear();
+  readahead_lines_.clear();
+  next_read_ = 0;
+  next_pop_ = 0;
+  const int num_readers = image_data_param.readers();
+  if (num_readers > 0) {
+    const int readahead = image_data_param.readahead() > 0 ?
+        image_data_param.readahead() : 2 * image_data_param.batch_size();
+    CHECK_GE(readahead, num_readers) << "Fewer files read ahead than readers";
+    LOG(INFO) << "Reading " << readahead << " files ahead with "
+        << num_readers << " readers";
+    // The readers are fed round-robin, so each one holds its share.
+    const int queue_size = (readahead + num_readers - 1) / num_readers;
+    for (int i = 0; i < num_readers; ++i) {
+      readers_.push_back(shared_ptr<ImageReader>(new ImageReader(queue_size)));
+      CHECK(readers_.back()->StartInternalThread())
+          << "Image reader thread could not be started";
+    }
+    for (int i = 0; i < readahead; ++i) {
+      ReadAhead();
+    }
+  }
 }
 
 template <typename Dtype>
@@ -90,43 +135,98 @@ void ImageDataLayer<Dtype>::ShuffleImages() {
   shuffle(lines_.begin(), lines_.end(), prefetch_rng);
 }
 
-// This function is used to create a thread that prefetches the data.
 template <typename Dtype>
-void ImageDataLayer<Dtype>::InternalThreadEntry() {
-  Datum datum;
-  CHECK(this->prefetch_data_.count());
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
-  Dtype* top_label = this->prefetch_label_.mutable_cpu_data();
-  ImageDataParameter image_data_param = this->layer_param_.image_data_param();
-  const int batch_size = image_data_param.batch_size();
-  const int new_height = image_data_param.new_height();
-  const int new_width = image_data_param.new_width();
-
-  // datum scales
+std::pair<std::string, int> ImageDataLayer<Dtype>::NextLine() {
   const int lines_size = lines_.size();
-  for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
-    CHECK_GT(lines_size, lines_id_);
-    if (!ReadImageToDatum(lines_[lines_id_].first,
-          lines_[lines_id_].second,
-          new_height, new_width, &datum)) {
-      continue;
+  CHECK_GT(lines_size, lines_id_);
+  // Copy the line, as the list may be shuffled below.
+  const std::pair<std::string, int> line = lines_[lines_id_];
+  // go to the next iter
+  lines_id_++;
+  if (lines_id_ >= lines_size) {
+    // We have reached the end. Restart from the first.
+    DLOG(INFO) << "Restarting data prefetching from start.";
+    lines_id_ = 0;
+    if (this->layer_param_.image_data_param().shuffle()) {
+      ShuffleImages();
+    }
+  }
+  return line;
+}
+
+template <typename Dtype>
+void ImageDataLayer<Dtype>::ReadAhead() {
+  readahead_lines_.push_back(NextLine());
+  readers_[next_read_]->Read(readahead_lines_.back().first);
+  next_read_ = (next_read_ + 1) % readers_.size();
+}
+
+// This function is called on the prefetch thread.
+template <typename Dtype>
+void ImageDataLayer<Dtype>::LoadBatch(Batch<Dtype>* batch) {
+  CHECK(batch->data_.count());
+  const int batch_size = this->layer_param_.image_data_param().batch_size();
+
+  // Pick the images on this thread, as the list may be reshuffled in the
+  // middle of the batch, and leave the decoding to FillBatchSlice.
+  prefetch_lines_.resize(batch_size);
+  if (readers_.empty()) {
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      prefetch_lines_[item_id] = NextLine();
+    }
+  } else {
+    // Take the files read ahead, in the order they were queued, and queue
+    // as many new ones.
+    prefetch_files_.resize(batch_size);
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      prefetch_lines_[item_id] = readahead_lines_.front();
+      readahead_lines_.pop_front();
+      readers_[next_pop_]->Pop(&prefetch_files_[item_id]);
+      next_pop_ = (next_pop_ + 1) % readers_.size();
+      ReadAhead();
     }
+  }
+  this->FillBatchInParallel(batch);
+}
 
-    // Apply transformations (mirror, crop...) to the data
-    this->data_transformer_.Transform(item_id, datum, this->mean_, top_data);
-
-    top_label[item_id] = datum.label();
-    // go to the next iter
-    lines_id_++;
-    if (lines_id_ >= lines_size) {
-      // We have reached the end. Restart from the first.
-      DLOG(INFO) << "Restarting data prefetching from start.";
-      lines_id_ = 0;
-      if (this->layer_param_.image_data_param().shuffle()) {
-        ShuffleImages();
+template <typename Dtype>
+void ImageDataLayer<Dtype>::FillBatchSlice(const int slice_id,
+    const int item_begin, const int item_end, Dtype* top_data,
+    Dtype* top_label) {
+  DataTransformer<Dtype>* transformer = this->slice_transformer(slice_id);
+  const int new_height = this->layer_param_.image_data_param().new_height();
+  const int new_width = this->layer_param_.image_data_param().new_width();
+  const int slice_size = item_end - item_begin;
+  for (int item_id = item_begin; item_id < item_end; ++item_id) {
+    // An image that cannot be loaded is logged and replaced by the next one
+    // of the slice, with its label, rather than stopping the training from
+    // this thread.
+    int source_id = item_id;
+    cv::Mat cv_img;
+    for (int i = 0; i < slice_size && !cv_img.data; ++i) {
+      source_id = item_begin + (item_id - item_begin + i) % slice_size;
+      cv_img = readers_.empty() ?
+          ReadImageToCVMat(prefetch_lines_[source_id].first, new_height,
+              new_width, true) :
+          DecodeImageToCVMat(prefetch_files_[source_id], new_height,
+              new_width, true);
+      if (!cv_img.data) {
+        LOG(ERROR) << "Could not load " << prefetch_lines_[source_id].first;
       }
     }
+    CHECK(cv_img.data) << "Could not load any image of the batch slice";
+    const string& filename = prefetch_lines_[source_id].first;
+    CHECK(cv_img.channels() == this->datum_channels_ &&
+          cv_img.rows == this->datum_height_ &&
+          cv_img.cols == this->datum_width_)
+        << "The size of " << filename << " differs from the first image; "
+        << "set new_height and new_width to resize the images";
+
+    // Apply transformations (mirror, crop...) to the decoded image directly
+    transformer->Transform(item_id, cv_img, this->mean_, top_data);
+
+    this->SetLabel(item_id, prefetch_lines_[source_id].second,
+        transformer->num_crops(), top_label);
   }
 }
 
@@ -18,6 +18,8 @@ void MemoryDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   CHECK_GT(batch_size_ * this->datum_size_, 0) <<
       "batch_size, channels, height, and width must be specified and"
       " positive in memory_data_param";
+  CHECK_EQ(this->data_transformer_.num_crops(), 1)
+      << "MemoryDataLayer does not support test_crops";
   (*top)[0]->Reshape(batch_size_, this->datum_channels_, this->datum_height_,
                      this->datum_width_);
   (*top)[1]->Reshape(batch_size_, 1, 1, 1);
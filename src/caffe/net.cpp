@@ -216,6 +216,9 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   GetLearningRateAndWeightDecay();
+  if (param.share_blob_memory()) {
+    PlanBlobMemory();
+  }
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
   // Don't display debug info by default.
@@ -497,6 +500,143 @@ void Net<Dtype>::GetLearningRateAndWeightDecay() {
   }
 }
 
+// Helper for Net::PlanBlobMemory: records that the memory item is used at
+// step, and whether the first use of the item writes it.
+static void UseBlobMemory(const int item, const int step, const bool write,
+    vector<int>* first, vector<int>* last, vector<bool>* first_writes) {
+  if ((*first)[item] < 0 || step < (*first)[item]) {
+    (*first)[item] = step;
+    (*first_writes)[item] = write;
+  } else if (step == (*first)[item]) {
+    (*first_writes)[item] = (*first_writes)[item] || write;
+  }
+  (*last)[item] = std::max((*last)[item], step);
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanBlobMemory() {
+  // The memory items are the data (2 * blob_id) and the diff
+  // (2 * blob_id + 1) of each blob. Layer i runs forward at step i and
+  // backward at step 2 * num_layers - 1 - i.
+  const int num_layers = layers_.size();
+  const int num_items = 2 * blobs_.size();
+  vector<int> first(num_items, -1);
+  vector<int> last(num_items, -1);
+  vector<bool> first_writes(num_items, false);
+  vector<bool> plannable(num_items, true);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    plannable[2 * net_input_blob_indices_[i]] = false;
+    plannable[2 * net_input_blob_indices_[i] + 1] = false;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    plannable[2 * net_output_blob_indices_[i]] = false;
+    plannable[2 * net_output_blob_indices_[i] + 1] = false;
+  }
+  for (int blob_id = 0; blob_id < blob_loss_weights_.size(); ++blob_id) {
+    // The loss weights are set in the diff once by the layer setup.
+    if (blob_loss_weights_[blob_id] != Dtype(0)) {
+      plannable[2 * blob_id + 1] = false;
+    }
+  }
+  for (int layer_id = 0; layer_id < num_layers; ++layer_id) {
+    const int backward_step = 2 * num_layers - 1 - layer_id;
+    const bool backward = layer_need_backward_[layer_id];
+    const bool shares = layers_[layer_id]->SharesBlobMemory();
+    // The layer may read its bottoms and tops, and write its bottom diffs,
+    // in backward.
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int data = 2 * bottom_id_vecs_[layer_id][i];
+      if (shares) {
+        plannable[data] = plannable[data + 1] = false;
+      }
+      UseBlobMemory(data, layer_id, false, &first, &last, &first_writes);
+      if (backward) {
+        UseBlobMemory(data, backward_step, false, &first, &last,
+            &first_writes);
+        UseBlobMemory(data + 1, backward_step, true, &first, &last,
+            &first_writes);
+      }
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int data = 2 * top_id_vecs_[layer_id][i];
+      if (shares) {
+        plannable[data] = plannable[data + 1] = false;
+      }
+      UseBlobMemory(data, layer_id, true, &first, &last, &first_writes);
+      if (backward) {
+        UseBlobMemory(data, backward_step, false, &first, &last,
+            &first_writes);
+        UseBlobMemory(data + 1, backward_step, false, &first, &last,
+            &first_writes);
+      }
+    }
+  }
+  // Plan the items that are written before they are read, by start step.
+  vector<pair<int, int> > items;
+  size_t unshared_bytes = 0;
+  for (int item = 0; item < num_items; ++item) {
+    if (plannable[item] && first[item] >= 0 && first_writes[item] &&
+        blobs_[item / 2]->count() > 0) {
+      items.push_back(make_pair(first[item], item));
+      unshared_bytes += blobs_[item / 2]->count() * sizeof(Dtype);
+    }
+  }
+  std::sort(items.begin(), items.end());
+  // Give each item the smallest free slab large enough, or else the largest
+  // free slab, grown, or else a new slab.
+  vector<size_t> slab_sizes;
+  vector<int> slab_ends;
+  vector<int> item_slabs(num_items, -1);
+  for (int i = 0; i < items.size(); ++i) {
+    const int item = items[i].second;
+    const size_t size = blobs_[item / 2]->count() * sizeof(Dtype);
+    int best = -1;
+    for (int slab = 0; slab < slab_sizes.size(); ++slab) {
+      if (slab_ends[slab] >= first[item]) {
+        continue;
+      }
+      if (best < 0) {
+        best = slab;
+      } else if (slab_sizes[best] < size) {
+        if (slab_sizes[slab] > slab_sizes[best]) {
+          best = slab;
+        }
+      } else if (slab_sizes[slab] >= size &&
+          slab_sizes[slab] < slab_sizes[best]) {
+        best = slab;
+      }
+    }
+    if (best < 0) {
+      best = slab_sizes.size();
+      slab_sizes.push_back(0);
+      slab_ends.push_back(-1);
+    }
+    slab_sizes[best] = std::max(slab_sizes[best], size);
+    slab_ends[best] = last[item];
+    item_slabs[item] = best;
+  }
+  vector<shared_ptr<SyncedMemory> > slabs;
+  size_t shared_bytes = 0;
+  for (int slab = 0; slab < slab_sizes.size(); ++slab) {
+    slabs.push_back(shared_ptr<SyncedMemory>(
+        new SyncedMemory(slab_sizes[slab])));
+    shared_bytes += slab_sizes[slab];
+  }
+  for (int item = 0; item < num_items; ++item) {
+    if (item_slabs[item] < 0) {
+      continue;
+    }
+    if (item % 2 == 0) {
+      blobs_[item / 2]->set_data(slabs[item_slabs[item]]);
+    } else {
+      blobs_[item / 2]->set_diff(slabs[item_slabs[item]]);
+    }
+  }
+  LOG(INFO) << "Sharing the memory of " << items.size()
+      << " blob data and diffs in " << slabs.size() << " slabs: "
+      << shared_bytes << " bytes instead of " << unshared_bytes;
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
@@ -783,17 +923,27 @@ void Net<Dtype>::Update() {
   }
 }
 
-// added for allowing bigger batch size
 template <typename Dtype>
-void Net<Dtype>::AccumulateDiff(){
-  for (int i = 0; i < params_.size(); ++i)
-    params_[i]->AccumulateDiff();
-}
-
-template <typename Dtype>
-void Net<Dtype>::UpdateDiff(){
-  for (int i = 0; i < params_.size(); ++i)
-    params_[i]->UpdateDiff();
+void Net<Dtype>::ClearParamDiffs() {
+  for (int i = 0; i < params_.size(); ++i) {
+    Blob<Dtype>* blob = params_[i].get();
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      caffe_set(blob->count(), static_cast<Dtype>(0),
+          blob->mutable_cpu_diff());
+      break;
+    case Caffe::GPU:
+#ifndef CPU_ONLY
+      caffe_gpu_set(blob->count(), static_cast<Dtype>(0),
+          blob->mutable_gpu_diff());
+#else
+      NO_GPU;
+#endif
+      break;
+    default:
+      LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+    }
+  }
 }
 
 template <typename Dtype>
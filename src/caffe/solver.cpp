@@ -35,11 +35,7 @@ void Solver<Dtype>::Init(const SolverParameter& param) {
   if (param_.random_seed() >= 0) {
     Caffe::set_random_seed(param_.random_seed());
   }
-  // added for allowing bigger batch size
-  if (!param_.has_update_interval() || param_.update_interval() == 1)
-    Caffe::set_accumulate(false);
-  else
-    Caffe::set_accumulate(true);
+  CHECK_GE(param_.update_interval(), 1);
   // Scaffolding code
   InitTrainNet();
   InitTestNets();
@@ -193,19 +189,14 @@ void Solver<Dtype>::Solve(const char* resume_file) {
     const bool debug_display = param_.debug_info() && iter_ % param_.debug_display() == 0;
     net_->set_debug_info(debug_display);
 
-    // added for allowing bigger batch size
+    // The gradients of the update_interval batches add up in the param
+    // diffs.
+    net_->ClearParamDiffs();
     Dtype loss = 0;
-    if ( !Caffe::accumulate() )
-      loss = net_->ForwardBackward(bottom_vec);
-    else{
-      for (int acum_num = 0; acum_num < param_.update_interval() - 1; ++acum_num){
-        loss += net_->ForwardBackward(bottom_vec);
-        net_->AccumulateDiff();
-      }
+    for (int i = 0; i < param_.update_interval(); ++i) {
       loss += net_->ForwardBackward(bottom_vec);
-      net_->UpdateDiff();
-      loss /= Dtype(param_.update_interval());
     }
+    loss /= param_.update_interval();
 
     if (display) {
       LOG(INFO) << "Iteration " << iter_ << ", loss = " << loss;
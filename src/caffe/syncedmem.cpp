@@ -21,8 +21,9 @@ SyncedMemory::~SyncedMemory() {
 inline void SyncedMemory::to_cpu() {
   switch (head_) {
   case UNINITIALIZED:
-    CaffeMallocHost(&cpu_ptr_, size_);
-    caffe_memset(size_, 0, cpu_ptr_);
+    // The allocator zeroes the memory, unless it is fresh from the system,
+    // leaving its first touch to the threads that compute it.
+    CaffeMallocHost(&cpu_ptr_, size_, true);
     head_ = HEAD_AT_CPU;
     own_cpu_data_ = true;
     break;
@@ -54,4 +54,16 @@ TYPED_TEST(BlobSimpleTest, TestReshape) {
   EXPECT_EQ(this->blob_->count(), 120);
 }
 
+TYPED_TEST(BlobSimpleTest, TestReshapeDiff) {
+  this->blob_->Reshape(2, 3, 4, 5);
+  EXPECT_TRUE(this->blob_->mutable_cpu_data());
+  EXPECT_FALSE(this->blob_->has_diff());
+  EXPECT_TRUE(this->blob_->mutable_cpu_diff());
+  EXPECT_TRUE(this->blob_->has_diff());
+  // Growing the blob drops its diff, to be created again of the new size.
+  this->blob_->Reshape(2, 3, 4, 6);
+  EXPECT_FALSE(this->blob_->has_diff());
+  EXPECT_EQ(144 * sizeof(TypeParam), this->blob_->diff()->size());
+}
+
 }  // namespace caffe
@@ -1,13 +1,17 @@
 #include <string>
 #include <vector>
 
+#include "boost/scoped_ptr.hpp"
 #include "gtest/gtest.h"
-#include "leveldb/db.h"
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/flat_dataset.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/vision_layers.hpp"
 
@@ -15,6 +19,8 @@
 
 namespace caffe {
 
+using boost::scoped_ptr;
+
 template <typename TypeParam>
 class DataLayerTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -24,28 +30,32 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
       : backend_(DataParameter_DB_LEVELDB),
         blob_top_data_(new Blob<Dtype>()),
         blob_top_label_(new Blob<Dtype>()),
-        seed_(1701) {}
+        seed_(1701),
+        threads_(1),
+        prefetch_(4),
+        readers_per_source_(1),
+        cache_in_memory_(false) {}
   virtual void SetUp() {
     filename_.reset(new string());
     MakeTempDir(filename_.get());
     *filename_ += "/db";
+    shard_filename_.reset(new string());
+    MakeTempDir(shard_filename_.get());
+    *shard_filename_ += "/db";
     blob_top_vec_.push_back(blob_top_data_);
     blob_top_vec_.push_back(blob_top_label_);
   }
 
-  // Fill the LevelDB with data: if unique_pixels, each pixel is unique but
+  // Fill the DB with data: if unique_pixels, each pixel is unique but
   // all images are the same; else each image is unique but all pixels within
   // an image are the same.
-  void FillLevelDB(const bool unique_pixels) {
-    backend_ = DataParameter_DB_LEVELDB;
-    LOG(INFO) << "Using temporary leveldb " << *filename_;
-    leveldb::DB* db;
-    leveldb::Options options;
-    options.error_if_exists = true;
-    options.create_if_missing = true;
-    leveldb::Status status =
-        leveldb::DB::Open(options, filename_->c_str(), &db);
-    CHECK(status.ok());
+  void Fill(const bool unique_pixels, const string& filename,
+      DataParameter_DB backend) {
+    backend_ = backend;
+    LOG(INFO) << "Using temporary dataset " << filename;
+    scoped_ptr<db::DB> db(db::GetDB(backend));
+    db->Open(filename, db::NEW);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
     for (int i = 0; i < 5; ++i) {
       Datum datum;
       datum.set_label(i);
@@ -59,57 +69,78 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
       }
       stringstream ss;
       ss << i;
-      db->Put(leveldb::WriteOptions(), ss.str(), datum.SerializeAsString());
+      txn->Put(ss.str(), datum.SerializeAsString());
     }
-    delete db;
+    txn->Commit();
+    db->Close();
+  }
+
+  void FillLevelDB(const bool unique_pixels) {
+    Fill(unique_pixels, *filename_, DataParameter_DB_LEVELDB);
+  }
+
+  void FillLevelDB(const bool unique_pixels, const string& filename) {
+    Fill(unique_pixels, filename, DataParameter_DB_LEVELDB);
   }
 
-  // Fill the LMDB with data: unique_pixels has same meaning as in FillLevelDB.
   void FillLMDB(const bool unique_pixels) {
-    backend_ = DataParameter_DB_LMDB;
-    LOG(INFO) << "Using temporary lmdb " << *filename_;
-    CHECK_EQ(mkdir(filename_->c_str(), 0744), 0) << "mkdir " << filename_
-                                                 << "failed";
-    MDB_env *env;
-    MDB_dbi dbi;
-    MDB_val mdbkey, mdbdata;
-    MDB_txn *txn;
-    CHECK_EQ(mdb_env_create(&env), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(env, 1099511627776), MDB_SUCCESS)  // 1TB
-        << "mdb_env_set_mapsize failed";
-    CHECK_EQ(mdb_env_open(env, filename_->c_str(), 0, 0664), MDB_SUCCESS)
-        << "mdb_env_open failed";
-    CHECK_EQ(mdb_txn_begin(env, NULL, 0, &txn), MDB_SUCCESS)
-        << "mdb_txn_begin failed";
-    CHECK_EQ(mdb_open(txn, NULL, 0, &dbi), MDB_SUCCESS) << "mdb_open failed";
+    Fill(unique_pixels, *filename_, DataParameter_DB_LMDB);
+  }
 
-    for (int i = 0; i < 5; ++i) {
+  void FillLMDB(const bool unique_pixels, const string& filename) {
+    Fill(unique_pixels, filename, DataParameter_DB_LMDB);
+  }
+
+  void FillRecordFile(const bool unique_pixels) {
+    Fill(unique_pixels, *filename_, DataParameter_DB_RECORDFILE);
+  }
+
+  void FillRecordFile(const bool unique_pixels, const string& filename) {
+    Fill(unique_pixels, filename, DataParameter_DB_RECORDFILE);
+  }
+
+  // Convert the records of a LevelDB to a flat dataset, as
+  // tools/convert_db_to_flat does.
+  void FillFlat(const bool unique_pixels, FlatDataset::DataType data_type,
+      const bool write_index) {
+    const string db_filename = *filename_ + "_leveldb";
+    Fill(unique_pixels, db_filename, DataParameter_DB_LEVELDB);
+    backend_ = DataParameter_DB_FLAT;
+    scoped_ptr<db::DB> db(db::GetDB(DataParameter_DB_LEVELDB));
+    db->Open(db_filename, db::READ);
+    scoped_ptr<db::Cursor> cursor(db->NewCursor());
+    FlatDatasetWriter writer;
+    writer.Open(*filename_, data_type, write_index);
+    for (; cursor->valid(); cursor->Next()) {
       Datum datum;
-      datum.set_label(i);
-      datum.set_channels(2);
-      datum.set_height(3);
-      datum.set_width(4);
-      std::string* data = datum.mutable_data();
-      for (int j = 0; j < 24; ++j) {
-        int datum = unique_pixels ? j : i;
-        data->push_back(static_cast<uint8_t>(datum));
-      }
+      datum.ParseFromString(cursor->value());
+      writer.Write(datum);
+    }
+    writer.Close();
+  }
+
+  // Fill the LMDB with encoded images of 3 x 3 x 4 pixels; the pixels of
+  // image i are all i. With gray_item, that image is stored with 1 channel.
+  void FillEncodedLMDB(const int gray_item = -1) {
+    backend_ = DataParameter_DB_LMDB;
+    scoped_ptr<db::DB> db(db::GetDB(backend_));
+    db->Open(*filename_, db::NEW);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    for (int i = 0; i < 5; ++i) {
+      cv::Mat image = i == gray_item ? cv::Mat(3, 4, CV_8UC1, cv::Scalar(i)) :
+          cv::Mat(3, 4, CV_8UC3, cv::Scalar(i, i, i));
       stringstream ss;
+      ss << *filename_ << "_" << i << ".png";
+      CHECK(cv::imwrite(ss.str(), image));
+      Datum datum;
+      CHECK(ReadFileToDatum(ss.str(), i, &datum));
+      CHECK(datum.encoded());
+      ss.str("");
       ss << i;
-
-      string value;
-      datum.SerializeToString(&value);
-      mdbdata.mv_size = value.size();
-      mdbdata.mv_data = reinterpret_cast<void*>(&value[0]);
-      string keystr = ss.str();
-      mdbkey.mv_size = keystr.size();
-      mdbkey.mv_data = reinterpret_cast<void*>(&keystr[0]);
-      CHECK_EQ(mdb_put(txn, dbi, &mdbkey, &mdbdata, 0), MDB_SUCCESS)
-          << "mdb_put failed";
+      txn->Put(ss.str(), datum.SerializeAsString());
     }
-    CHECK_EQ(mdb_txn_commit(txn), MDB_SUCCESS) << "mdb_txn_commit failed";
-    mdb_close(env, dbi);
-    mdb_env_close(env);
+    txn->Commit();
+    db->Close();
   }
 
   void TestRead() {
@@ -119,10 +150,14 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_prefetch(prefetch_);
+    data_param->set_readers_per_source(readers_per_source_);
+    data_param->set_cache_in_memory(cache_in_memory_);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
     transform_param->set_scale(scale);
+    transform_param->set_threads(threads_);
 
     DataLayer<Dtype> layer(param);
     layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
@@ -149,6 +184,140 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Test that every epoch reads all the records once, in a random order.
+  void TestReadShuffle() {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle(true);
+    data_param->set_shuffle_window(2);
+
+    Caffe::set_random_seed(seed_);
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    int in_order_epochs = 0;
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      vector<bool> seen(5, false);
+      bool in_order = true;
+      for (int i = 0; i < 5; ++i) {
+        const int label = blob_top_label_->cpu_data()[i];
+        ASSERT_GE(label, 0);
+        ASSERT_LT(label, 5);
+        EXPECT_FALSE(seen[label]) << "debug: iter " << iter << " i " << i;
+        seen[label] = true;
+        in_order &= label == i;
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j]);
+        }
+      }
+      in_order_epochs += in_order;
+    }
+    EXPECT_LT(in_order_epochs, 10);
+  }
+
+  // Read from filename_ and shard_filename_, which were filled alike with
+  // unique_pixels false.
+  void TestReadShards() {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->add_shard_source(shard_filename_->c_str());
+    data_param->set_backend(backend_);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        // The records alternate between the two databases.
+        const int record = iter * 5 + i;
+        const int label = (record / 2) % 5;
+        EXPECT_EQ(label, blob_top_label_->cpu_data()[i]);
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+
+  // Read shard 1 of 2 of the 5 records, filled with unique_pixels false:
+  // records 1 and 3 with a STRIDE split, 2 to 4 with a RANGE split.
+  void TestReadDataShard(DataParameter::ShardMode mode) {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_readers_per_source(readers_per_source_);
+    data_param->set_cache_in_memory(cache_in_memory_);
+    data_param->set_shard_id(1);
+    data_param->set_num_shards(2);
+    data_param->set_shard_mode(mode);
+    vector<int> shard;
+    if (mode == DataParameter_ShardMode_STRIDE) {
+      shard.push_back(1);
+      shard.push_back(3);
+    } else {
+      shard.push_back(2);
+      shard.push_back(3);
+      shard.push_back(4);
+    }
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    for (int iter = 0; iter < 4; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        const int label = shard[(iter * 5 + i) % shard.size()];
+        EXPECT_EQ(label, blob_top_label_->cpu_data()[i]);
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+  }
+
+  // Read one epoch of each shard of 2 after a random skip: together the
+  // shards hold each of the 5 records exactly once.
+  void TestReadDataShardSkip(DataParameter::ShardMode mode) {
+    for (int seed = 0; seed < 4; ++seed) {
+      Caffe::set_random_seed(seed_ + seed);
+      vector<int> count(5, 0);
+      for (int shard_id = 0; shard_id < 2; ++shard_id) {
+        LayerParameter param;
+        DataParameter* data_param = param.mutable_data_param();
+        // STRIDE shards 0 and 1 hold 3 and 2 records, RANGE ones 2 and 3.
+        const bool larger_shard =
+            (mode == DataParameter_ShardMode_STRIDE) == (shard_id == 0);
+        data_param->set_batch_size(larger_shard ? 3 : 2);
+        data_param->set_source(filename_->c_str());
+        data_param->set_backend(backend_);
+        data_param->set_readers_per_source(readers_per_source_);
+        data_param->set_cache_in_memory(cache_in_memory_);
+        data_param->set_rand_skip(5);
+        data_param->set_shard_id(shard_id);
+        data_param->set_num_shards(2);
+        data_param->set_shard_mode(mode);
+
+        DataLayer<Dtype> layer(param);
+        layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+        layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+        for (int i = 0; i < blob_top_label_->num(); ++i) {
+          ++count[static_cast<int>(blob_top_label_->cpu_data()[i])];
+        }
+      }
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(1, count[i]) << "seed " << seed << " record " << i;
+      }
+    }
+  }
+
   void TestReadCrop() {
     const Dtype scale = 3;
     LayerParameter param;
@@ -202,6 +371,44 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  void TestReadMultiCrop() {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_crop_size(2);
+    transform_param->set_test_crops(5);
+    transform_param->set_threads(threads_);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), 25);
+    EXPECT_EQ(blob_top_data_->channels(), 2);
+    EXPECT_EQ(blob_top_data_->height(), 2);
+    EXPECT_EQ(blob_top_data_->width(), 2);
+    EXPECT_EQ(blob_top_label_->num(), 25);
+
+    // The top-left pixel of the center crop and of the 4 corners.
+    const int crop_origins[5] = { 1, 0, 2, 4, 6 };
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        for (int k = 0; k < 5; ++k) {
+          EXPECT_EQ(i, blob_top_label_->cpu_data()[i * 5 + k]);
+          for (int c = 0; c < 2; ++c) {
+            EXPECT_EQ(c * 12 + crop_origins[k],
+                blob_top_data_->data_at(i * 5 + k, c, 0, 0))
+                << "debug: iter " << iter << " i " << i << " k " << k;
+          }
+        }
+      }
+    }
+  }
+
   void TestReadCropTrainSequenceSeeded() {
     LayerParameter param;
     DataParameter* data_param = param.mutable_data_param();
@@ -213,6 +420,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
         param.mutable_transform_param();
     transform_param->set_crop_size(1);
     transform_param->set_mirror(true);
+    transform_param->set_threads(threads_);
 
     // Get crop sequence with Caffe seed 1701.
     Caffe::set_random_seed(seed_);
@@ -316,11 +524,16 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
 
   DataParameter_DB backend_;
   shared_ptr<string> filename_;
+  shared_ptr<string> shard_filename_;
   Blob<Dtype>* const blob_top_data_;
   Blob<Dtype>* const blob_top_label_;
   vector<Blob<Dtype>*> blob_bottom_vec_;
   vector<Blob<Dtype>*> blob_top_vec_;
   int seed_;
+  int threads_;
+  int prefetch_;
+  int readers_per_source_;
+  bool cache_in_memory_;
 };
 
 TYPED_TEST_CASE(DataLayerTest, TestDtypesAndDevices);
@@ -356,6 +569,56 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDB) {
   this->TestReadCropTrainSequenceUnseeded();
 }
 
+TYPED_TEST(DataLayerTest, TestReadThreadedLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->threads_ = 3;
+  this->TestRead();
+}
+
+// Test that the sequence of random crops is consistent when using
+// Caffe::set_random_seed and several prefetch threads.
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededThreadedLevelDB) {
+  Caffe::set_phase(Caffe::TRAIN);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillLevelDB(unique_pixels);
+  this->threads_ = 3;
+  this->TestReadCropTrainSequenceSeeded();
+}
+
+// Test reading each record with its own cursor.
+TYPED_TEST(DataLayerTest, TestReadParallelReadersLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->readers_per_source_ = 5;
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardsLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->FillLevelDB(unique_pixels, *this->shard_filename_);
+  this->TestReadShards();
+}
+
+TYPED_TEST(DataLayerTest, TestReadStrideShardLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadDataShard(DataParameter_ShardMode_STRIDE);
+}
+
+TYPED_TEST(DataLayerTest, TestReadStrideShardSkipLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadDataShardSkip(DataParameter_ShardMode_STRIDE);
+}
+
+TYPED_TEST(DataLayerTest, TestReadRangeShardLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadDataShard(DataParameter_ShardMode_RANGE);
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTestLevelDB) {
   Caffe::set_phase(Caffe::TEST);
   const bool unique_pixels = true;  // all images the same; pixels different
@@ -369,6 +632,75 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadSinglePrefetchLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->prefetch_ = 1;
+  this->TestRead();
+}
+
+// Test that the top blobs share the prefetch batches instead of copying them.
+TYPED_TEST(DataLayerTest, TestSharePrefetchBatchLMDB) {
+  typedef typename TypeParam::Dtype Dtype;
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  LayerParameter param;
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(5);
+  data_param->set_source(this->filename_->c_str());
+  data_param->set_backend(this->backend_);
+  data_param->set_prefetch(2);
+
+  DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  vector<const Dtype*> top_data;
+  for (int iter = 0; iter < 4; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+      EXPECT_EQ(i, this->blob_top_data_->cpu_data()[i * 24]);
+    }
+    top_data.push_back(this->blob_top_data_->cpu_data());
+  }
+  EXPECT_NE(top_data[0], top_data[1]);
+  EXPECT_EQ(top_data[0], top_data[2]);
+  EXPECT_EQ(top_data[1], top_data[3]);
+}
+
+TYPED_TEST(DataLayerTest, TestReadParallelReadersLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->readers_per_source_ = 5;
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardsLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->FillLMDB(unique_pixels, *this->shard_filename_);
+  this->TestReadShards();
+}
+
+TYPED_TEST(DataLayerTest, TestReadStrideShardParallelReadersLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->readers_per_source_ = 2;
+  this->TestReadDataShard(DataParameter_ShardMode_STRIDE);
+}
+
+TYPED_TEST(DataLayerTest, TestReadStrideShardSkipParallelReadersLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->readers_per_source_ = 2;
+  this->TestReadDataShardSkip(DataParameter_ShardMode_STRIDE);
+}
+
+TYPED_TEST(DataLayerTest, TestReadRangeShardLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->TestReadDataShard(DataParameter_ShardMode_RANGE);
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLMDB) {
   Caffe::set_phase(Caffe::TRAIN);
   const bool unique_pixels = true;  // all images the same; pixels different
@@ -401,4 +733,185 @@ TYPED_TEST(DataLayerTest, TestReadCropTestLMDB) {
   this->TestReadCrop();
 }
 
+TYPED_TEST(DataLayerTest, TestReadMultiCropLMDB) {
+  Caffe::set_phase(Caffe::TEST);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillLMDB(unique_pixels);
+  this->threads_ = 2;
+  this->TestReadMultiCrop();
+}
+
+TYPED_TEST(DataLayerTest, TestReadRecordFile) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillRecordFile(unique_pixels);
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadParallelReadersRecordFile) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillRecordFile(unique_pixels);
+  this->readers_per_source_ = 5;
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededRecordFile) {
+  Caffe::set_phase(Caffe::TRAIN);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillRecordFile(unique_pixels);
+  this->TestReadCropTrainSequenceSeeded();
+}
+
+TYPED_TEST(DataLayerTest, TestReadFlat) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillFlat(unique_pixels, FlatDataset::UINT8, false);
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadFloatIndexedFlat) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillFlat(unique_pixels, FlatDataset::FLOAT, true);
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededFlat) {
+  Caffe::set_phase(Caffe::TRAIN);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillFlat(unique_pixels, FlatDataset::UINT8, false);
+  this->TestReadCropTrainSequenceSeeded();
+}
+
+TYPED_TEST(DataLayerTest, TestReadStrideShardFlat) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillFlat(unique_pixels, FlatDataset::UINT8, false);
+  this->TestReadDataShard(DataParameter_ShardMode_STRIDE);
+}
+
+TYPED_TEST(DataLayerTest, TestReadRangeShardFlat) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillFlat(unique_pixels, FlatDataset::UINT8, false);
+  this->TestReadDataShard(DataParameter_ShardMode_RANGE);
+}
+
+TYPED_TEST(DataLayerTest, TestReadStrideShardSkipFlat) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillFlat(unique_pixels, FlatDataset::UINT8, false);
+  this->TestReadDataShardSkip(DataParameter_ShardMode_STRIDE);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCropTestFlat) {
+  Caffe::set_phase(Caffe::TEST);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillFlat(unique_pixels, FlatDataset::FLOAT, false);
+  this->TestReadCrop();
+}
+
+TYPED_TEST(DataLayerTest, TestReadEncodedLMDB) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->FillEncodedLMDB();
+  LayerParameter param;
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(5);
+  data_param->set_source(this->filename_->c_str());
+  data_param->set_backend(this->backend_);
+  param.mutable_transform_param()->set_threads(2);
+
+  DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 5);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3);
+  EXPECT_EQ(this->blob_top_data_->height(), 3);
+  EXPECT_EQ(this->blob_top_data_->width(), 4);
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+      for (int j = 0; j < 36; ++j) {
+        EXPECT_EQ(i, this->blob_top_data_->cpu_data()[i * 36 + j]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(DataLayerTest, TestReadEncodedGrayInColorLMDB) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The first image, which sets the shape of the top, is grayscale: it is
+  // decoded to color like the others.
+  this->FillEncodedLMDB(0);
+  LayerParameter param;
+  DataParameter* data_param = param.mutable_data_param();
+  data_param->set_batch_size(5);
+  data_param->set_source(this->filename_->c_str());
+  data_param->set_backend(this->backend_);
+  param.mutable_transform_param()->set_threads(2);
+
+  DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 5);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3);
+  EXPECT_EQ(this->blob_top_data_->height(), 3);
+  EXPECT_EQ(this->blob_top_data_->width(), 4);
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+      for (int j = 0; j < 36; ++j) {
+        EXPECT_EQ(i, this->blob_top_data_->cpu_data()[i * 36 + j]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadShuffle();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->TestReadShuffle();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleRecordFile) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillRecordFile(unique_pixels);
+  this->TestReadShuffle();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleFlat) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillFlat(unique_pixels, FlatDataset::UINT8, false);
+  this->TestReadShuffle();
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheInMemoryLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->cache_in_memory_ = true;
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheInMemoryLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  this->cache_in_memory_ = true;
+  this->threads_ = 2;
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestCacheInMemorySharedLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLMDB(unique_pixels);
+  shared_ptr<FlatDataset> dataset =
+      FlatDataset::LoadShared(*this->filename_, DataParameter_DB_LMDB);
+  EXPECT_EQ(5, dataset->num());
+  EXPECT_EQ(2, dataset->channels());
+  EXPECT_EQ(3, dataset->label(3));
+  EXPECT_EQ(3, dataset->uint8_data(3)[23]);
+  // A second net caching the same source shares the records.
+  EXPECT_EQ(dataset.get(),
+      FlatDataset::LoadShared(*this->filename_, DataParameter_DB_LMDB).get());
+}
+
 }  // namespace caffe
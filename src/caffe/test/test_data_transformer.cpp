@@ -0,0 +1,389 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "opencv2/core/core.hpp"
+
+#include "caffe/common.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class DataTransformerTest : public ::testing::Test {
+ protected:
+  DataTransformerTest()
+      : channels_(3), height_(40), width_(41),
+        size_(channels_ * height_ * width_), scale_(0.5) {}
+
+  virtual void SetUp() {
+    Caffe::set_random_seed(1701);
+    // Rows of 41 pixels are transformed 16 at a time, then one by one.
+    data_.resize(size_);
+    mean_.resize(size_);
+    for (int i = 0; i < size_; ++i) {
+      data_[i] = caffe_rng_rand() % 256;
+      mean_[i] = static_cast<Dtype>(caffe_rng_rand() % 2560) / 10;
+    }
+  }
+
+  // Transforms data_ with the given crop, one element at a time.
+  void ReferenceTransform(const int crop_size, const int h_off,
+      const int w_off, const bool mirror, const vector<Dtype>& mean,
+      vector<Dtype>* transformed) {
+    transformed->resize(channels_ * crop_size * crop_size);
+    for (int c = 0; c < channels_; ++c) {
+      for (int h = 0; h < crop_size; ++h) {
+        for (int w = 0; w < crop_size; ++w) {
+          const int data_index = (c * height_ + h + h_off) * width_ + w +
+              w_off;
+          const int top_w = mirror ? crop_size - 1 - w : w;
+          (*transformed)[(c * crop_size + h) * crop_size + top_w] =
+              (static_cast<Dtype>(data_[data_index]) - mean[data_index]) *
+              scale_;
+        }
+      }
+    }
+  }
+
+  bool Equal(const vector<Dtype>& expected, const Dtype* transformed) {
+    for (int i = 0; i < expected.size(); ++i) {
+      if (std::fabs(expected[i] - transformed[i]) > 1e-4) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const int channels_;
+  const int height_;
+  const int width_;
+  const int size_;
+  const Dtype scale_;
+  vector<uint8_t> data_;
+  vector<Dtype> mean_;
+};
+
+TYPED_TEST_CASE(DataTransformerTest, TestDtypes);
+
+TYPED_TEST(DataTransformerTest, TestCropMirrorTrain) {
+  Caffe::set_phase(Caffe::TRAIN);
+  TransformationParameter param;
+  const int crop_size = 35;
+  param.set_crop_size(crop_size);
+  param.set_mirror(true);
+  param.set_scale(this->scale_);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  vector<TypeParam> transformed(2 * this->channels_ * crop_size * crop_size);
+  vector<TypeParam> expected;
+  int num_mirrored = 0;
+  const int num_iter = 20;
+  for (int iter = 0; iter < num_iter; ++iter) {
+    // Write the second item of a batch, at its offset in the blob.
+    transformer.Transform(1, &this->data_[0], this->channels_, this->height_,
+        this->width_, &this->mean_[0], &transformed[0]);
+    const TypeParam* item = &transformed[this->channels_ * crop_size *
+        crop_size];
+    // The result must be one of the possible crops.
+    bool found = false;
+    for (int h_off = 0; h_off < this->height_ - crop_size && !found;
+         ++h_off) {
+      for (int w_off = 0; w_off < this->width_ - crop_size && !found;
+           ++w_off) {
+        for (int mirror = 0; mirror < 2 && !found; ++mirror) {
+          this->ReferenceTransform(crop_size, h_off, w_off, mirror,
+              this->mean_, &expected);
+          if (this->Equal(expected, item)) {
+            found = true;
+            num_mirrored += mirror;
+          }
+        }
+      }
+    }
+    EXPECT_TRUE(found) << "iter " << iter;
+  }
+  EXPECT_GT(num_mirrored, 0);
+  EXPECT_LT(num_mirrored, num_iter);
+}
+
+TYPED_TEST(DataTransformerTest, TestCropTest) {
+  Caffe::set_phase(Caffe::TEST);
+  TransformationParameter param;
+  const int crop_size = 18;
+  param.set_crop_size(crop_size);
+  param.set_scale(this->scale_);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  vector<TypeParam> transformed(this->channels_ * crop_size * crop_size);
+  transformer.Transform(0, &this->data_[0], this->channels_, this->height_,
+      this->width_, &this->mean_[0], &transformed[0]);
+  vector<TypeParam> expected;
+  this->ReferenceTransform(crop_size, (this->height_ - crop_size) / 2,
+      (this->width_ - crop_size) / 2, false, this->mean_, &expected);
+  EXPECT_TRUE(this->Equal(expected, &transformed[0]));
+
+  // Float data takes the generic path and gives the same result.
+  vector<float> float_data(this->data_.begin(), this->data_.end());
+  transformer.Transform(0, &float_data[0], this->channels_, this->height_,
+      this->width_, &this->mean_[0], &transformed[0]);
+  EXPECT_TRUE(this->Equal(expected, &transformed[0]));
+}
+
+TYPED_TEST(DataTransformerTest, TestMultiCrop) {
+  Caffe::set_phase(Caffe::TEST);
+  TransformationParameter param;
+  const int crop_size = 18;
+  param.set_crop_size(crop_size);
+  param.set_scale(this->scale_);
+  param.set_test_crops(10);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  EXPECT_EQ(10, transformer.num_crops());
+  const int crop_count = this->channels_ * crop_size * crop_size;
+  vector<TypeParam> transformed(2 * 10 * crop_count);
+  // The second input of the batch makes items 10 to 19.
+  transformer.Transform(1, &this->data_[0], this->channels_, this->height_,
+      this->width_, &this->mean_[0], &transformed[0]);
+  const int h_end = this->height_ - crop_size;
+  const int w_end = this->width_ - crop_size;
+  const int h_offs[5] = { h_end / 2, 0, 0, h_end, h_end };
+  const int w_offs[5] = { w_end / 2, 0, w_end, 0, w_end };
+  vector<TypeParam> expected;
+  for (int i = 0; i < 10; ++i) {
+    this->ReferenceTransform(crop_size, h_offs[i % 5], w_offs[i % 5], i >= 5,
+        this->mean_, &expected);
+    EXPECT_TRUE(this->Equal(expected, &transformed[(10 + i) * crop_count]))
+        << "crop " << i;
+  }
+
+  // Training ignores test_crops.
+  Caffe::set_phase(Caffe::TRAIN);
+  DataTransformer<TypeParam> train_transformer(param);
+  EXPECT_EQ(1, train_transformer.num_crops());
+}
+
+TYPED_TEST(DataTransformerTest, TestCVMat) {
+  Caffe::set_phase(Caffe::TEST);
+  TransformationParameter param;
+  const int crop_size = 18;
+  param.set_crop_size(crop_size);
+  param.set_scale(this->scale_);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  // The same image with interleaved channels, in a wider image so that its
+  // rows are not contiguous.
+  cv::Mat cv_wide_img(this->height_, this->width_ + 3, CV_8UC3);
+  for (int h = 0; h < this->height_; ++h) {
+    for (int w = 0; w < this->width_; ++w) {
+      for (int c = 0; c < this->channels_; ++c) {
+        cv_wide_img.ptr<uchar>(h)[w * this->channels_ + c] =
+            this->data_[(c * this->height_ + h) * this->width_ + w];
+      }
+    }
+  }
+  cv::Mat cv_img = cv_wide_img(cv::Rect(0, 0, this->width_, this->height_));
+  vector<TypeParam> transformed(this->channels_ * crop_size * crop_size);
+  transformer.Transform(0, cv_img, &this->mean_[0], &transformed[0]);
+  vector<TypeParam> expected;
+  this->ReferenceTransform(crop_size, (this->height_ - crop_size) / 2,
+      (this->width_ - crop_size) / 2, false, this->mean_, &expected);
+  EXPECT_TRUE(this->Equal(expected, &transformed[0]));
+}
+
+TYPED_TEST(DataTransformerTest, TestMeanValues) {
+  Caffe::set_phase(Caffe::TEST);
+  TransformationParameter param;
+  param.set_scale(this->scale_);
+  for (int c = 0; c < this->channels_; ++c) {
+    param.add_mean_value(10 * (c + 1));
+  }
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  vector<TypeParam> transformed(this->size_);
+  // The mean image passed in is ignored in favor of the mean values.
+  transformer.Transform(0, &this->data_[0], this->channels_, this->height_,
+      this->width_, &this->mean_[0], &transformed[0]);
+  const int channel_size = this->height_ * this->width_;
+  for (int i = 0; i < this->size_; ++i) {
+    const int mean_value = 10 * (i / channel_size + 1);
+    EXPECT_NEAR((this->data_[i] - mean_value) * this->scale_, transformed[i],
+        1e-4);
+  }
+
+  // A single mean value applies to all the channels.
+  param.clear_mean_value();
+  param.add_mean_value(10);
+  DataTransformer<TypeParam> single_transformer(param);
+  single_transformer.InitRand();
+  single_transformer.Transform(0, &this->data_[0], this->channels_,
+      this->height_, this->width_, &this->mean_[0], &transformed[0]);
+  for (int i = 0; i < this->size_; ++i) {
+    EXPECT_NEAR((this->data_[i] - 10) * this->scale_, transformed[i], 1e-4);
+  }
+}
+
+TYPED_TEST(DataTransformerTest, TestAugmentGeometry) {
+  Caffe::set_phase(Caffe::TRAIN);
+  TransformationParameter param;
+  const int crop_size = 18;
+  param.set_crop_size(crop_size);
+  param.set_mirror(true);
+  param.set_scale(this->scale_);
+  param.set_min_scale(2);
+  param.set_max_scale(2);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  // Each pixel is twice its column, so zooming in 2x makes the top grow by
+  // 1 per column, or shrink if mirrored.
+  for (int i = 0; i < this->size_; ++i) {
+    this->data_[i] = 2 * (i % this->width_);
+  }
+  vector<TypeParam> zero_mean(this->size_, 0);
+  vector<TypeParam> transformed(this->channels_ * crop_size * crop_size);
+  int num_mirrored = 0;
+  const int num_iter = 20;
+  for (int iter = 0; iter < num_iter; ++iter) {
+    transformer.Transform(0, &this->data_[0], this->channels_, this->height_,
+        this->width_, &zero_mean[0], &transformed[0]);
+    const TypeParam step = (transformed[1] - transformed[0]) / this->scale_;
+    EXPECT_NEAR(1, std::fabs(step), 1e-3);
+    num_mirrored += step < 0;
+    for (int i = 0; i < transformed.size(); ++i) {
+      if (i % crop_size > 0) {
+        EXPECT_NEAR(step * this->scale_, transformed[i] - transformed[i - 1],
+            1e-3);
+      }
+    }
+  }
+  EXPECT_GT(num_mirrored, 0);
+  EXPECT_LT(num_mirrored, num_iter);
+
+  // Rotated, stretched and zoomed crops of a constant image stay constant.
+  param.set_min_scale(1.5);
+  param.set_max_aspect_ratio(1.2);
+  param.set_max_rotation(10);
+  DataTransformer<TypeParam> rotating_transformer(param);
+  rotating_transformer.InitRand();
+  std::fill(this->data_.begin(), this->data_.end(), 100);
+  for (int iter = 0; iter < num_iter; ++iter) {
+    rotating_transformer.Transform(0, &this->data_[0], this->channels_,
+        this->height_, this->width_, &zero_mean[0], &transformed[0]);
+    for (int i = 0; i < transformed.size(); ++i) {
+      EXPECT_NEAR(100 * this->scale_, transformed[i], 1e-3);
+    }
+  }
+}
+
+TYPED_TEST(DataTransformerTest, TestAugmentOutside) {
+  Caffe::set_phase(Caffe::TRAIN);
+  TransformationParameter param;
+  param.set_scale(this->scale_);
+  // Zooming the whole image out by 2x samples as much outside the image as
+  // inside. Those samples are the mean, like the image itself here, so the
+  // whole top is 0 with a mean image or mean values alike.
+  param.set_min_scale(0.5);
+  param.set_max_scale(0.5);
+  std::fill(this->data_.begin(), this->data_.end(), 100);
+  vector<TypeParam> mean(this->size_, 100);
+  vector<TypeParam> transformed(this->size_);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  transformer.Transform(0, &this->data_[0], this->channels_, this->height_,
+      this->width_, &mean[0], &transformed[0]);
+  for (int i = 0; i < this->size_; ++i) {
+    EXPECT_NEAR(0, transformed[i], 1e-3);
+  }
+  param.add_mean_value(100);
+  DataTransformer<TypeParam> mean_value_transformer(param);
+  mean_value_transformer.InitRand();
+  mean_value_transformer.Transform(0, &this->data_[0], this->channels_,
+      this->height_, this->width_, &mean[0], &transformed[0]);
+  for (int i = 0; i < this->size_; ++i) {
+    EXPECT_NEAR(0, transformed[i], 1e-3);
+  }
+}
+
+TYPED_TEST(DataTransformerTest, TestAugmentMean) {
+  Caffe::set_phase(Caffe::TRAIN);
+  TransformationParameter param;
+  const int crop_size = 18;
+  param.set_crop_size(crop_size);
+  param.set_mirror(true);
+  param.set_scale(this->scale_);
+  // A brightness too small to show turns the augmentations on without
+  // changing the pixels: the crops must match the plain ones, each pixel
+  // less the mean at its own position.
+  param.set_brightness(1e-6);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  vector<TypeParam> transformed(this->channels_ * crop_size * crop_size);
+  vector<TypeParam> expected;
+  for (int iter = 0; iter < 10; ++iter) {
+    transformer.Transform(0, &this->data_[0], this->channels_, this->height_,
+        this->width_, &this->mean_[0], &transformed[0]);
+    bool found = false;
+    for (int h_off = 0; h_off <= this->height_ - crop_size && !found;
+         ++h_off) {
+      for (int w_off = 0; w_off <= this->width_ - crop_size && !found;
+           ++w_off) {
+        for (int mirror = 0; mirror < 2 && !found; ++mirror) {
+          this->ReferenceTransform(crop_size, h_off, w_off, mirror,
+              this->mean_, &expected);
+          found = this->Equal(expected, &transformed[0]);
+        }
+      }
+    }
+    EXPECT_TRUE(found) << "iter " << iter;
+  }
+}
+
+TYPED_TEST(DataTransformerTest, TestAugmentPhotometric) {
+  Caffe::set_phase(Caffe::TRAIN);
+  TransformationParameter param;
+  const int crop_size = 18;
+  param.set_crop_size(crop_size);
+  param.set_brightness(20);
+  param.set_contrast(0.2);
+  param.set_color(0.1);
+  DataTransformer<TypeParam> transformer(param);
+  transformer.InitRand();
+  // Each channel is constant, and stays so.
+  const int channel_size = this->height_ * this->width_;
+  for (int i = 0; i < this->size_; ++i) {
+    this->data_[i] = 50 * (i / channel_size + 1);
+  }
+  vector<TypeParam> zero_mean(this->size_, 0);
+  const int top_channel_size = crop_size * crop_size;
+  vector<TypeParam> transformed(this->channels_ * top_channel_size);
+  TypeParam first_value = 0;
+  bool changed = false;
+  for (int iter = 0; iter < 10; ++iter) {
+    transformer.Transform(0, &this->data_[0], this->channels_, this->height_,
+        this->width_, &zero_mean[0], &transformed[0]);
+    for (int c = 0; c < this->channels_; ++c) {
+      const TypeParam value = transformed[c * top_channel_size];
+      const int pixel = 50 * (c + 1);
+      EXPECT_GE(value, pixel * 0.8 * 0.9 - 20);
+      EXPECT_LE(value, pixel * 1.2 * 1.1 + 20);
+      for (int i = 0; i < top_channel_size; ++i) {
+        EXPECT_NEAR(value, transformed[c * top_channel_size + i], 1e-3);
+      }
+    }
+    if (iter == 0) {
+      first_value = transformed[0];
+    } else {
+      changed |= transformed[0] != first_value;
+    }
+  }
+  EXPECT_TRUE(changed);
+}
+
+}  // namespace caffe
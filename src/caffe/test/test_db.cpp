@@ -0,0 +1,132 @@
+#include <string>
+
+#include "boost/scoped_ptr.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+using boost::scoped_ptr;
+
+template <DataParameter_DB backend>
+struct TypeDB {
+  static DataParameter_DB value() { return backend; }
+};
+
+template <typename TypeParam>
+class DBTest : public ::testing::Test {
+ protected:
+  DBTest() : backend_(TypeParam::value()) {}
+
+  virtual void SetUp() {
+    MakeTempDir(&source_);
+    source_ += "/db";
+    scoped_ptr<db::DB> db(db::GetDB(backend_));
+    db->Open(source_, db::NEW);
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    for (int i = 0; i < 2; ++i) {
+      txn->Put(Key(i), Value(i));
+    }
+    txn->Commit();
+    db->Close();
+  }
+
+  static string Key(int i) { return string("key_") + char('0' + i); }
+  static string Value(int i) { return string(1 + i, char('a' + i)); }
+
+  DataParameter_DB backend_;
+  string source_;
+};
+
+typedef ::testing::Types<TypeDB<DataParameter_DB_LEVELDB>,
+                         TypeDB<DataParameter_DB_LMDB>,
+                         TypeDB<DataParameter_DB_RECORDFILE> > TestTypes;
+
+TYPED_TEST_CASE(DBTest, TestTypes);
+
+TYPED_TEST(DBTest, TestGetDB) {
+  scoped_ptr<db::DB> db(db::GetDB(this->backend_));
+  db->Open(this->source_, db::READ);
+  db->Close();
+}
+
+TYPED_TEST(DBTest, TestNext) {
+  scoped_ptr<db::DB> db(db::GetDB(this->backend_));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(cursor->valid());
+    EXPECT_EQ(this->Key(i), cursor->key());
+    EXPECT_EQ(this->Value(i), cursor->value());
+    cursor->Next();
+  }
+  EXPECT_FALSE(cursor->valid());
+  cursor->SeekToFirst();
+  ASSERT_TRUE(cursor->valid());
+  EXPECT_EQ(this->Key(0), cursor->key());
+}
+
+TYPED_TEST(DBTest, TestSeek) {
+  scoped_ptr<db::DB> db(db::GetDB(this->backend_));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  cursor->Seek(this->Key(1));
+  ASSERT_TRUE(cursor->valid());
+  EXPECT_EQ(this->Key(1), cursor->key());
+  EXPECT_EQ(this->Value(1), cursor->value());
+  cursor->Seek(this->Key(0));
+  ASSERT_TRUE(cursor->valid());
+  EXPECT_EQ(this->Key(0), cursor->key());
+  cursor->Next();
+  ASSERT_TRUE(cursor->valid());
+  EXPECT_EQ(this->Key(1), cursor->key());
+  // Seeking past the last key leaves the cursor invalid.
+  cursor->Seek(this->Key(2));
+  EXPECT_FALSE(cursor->valid());
+}
+
+TYPED_TEST(DBTest, TestConcurrentCursors) {
+  scoped_ptr<db::DB> db(db::GetDB(this->backend_));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor0(db->NewCursor());
+  scoped_ptr<db::Cursor> cursor1(db->NewCursor());
+  cursor1->Next();
+  ASSERT_TRUE(cursor0->valid());
+  ASSERT_TRUE(cursor1->valid());
+  EXPECT_EQ(this->Key(0), cursor0->key());
+  EXPECT_EQ(this->Key(1), cursor1->key());
+}
+
+TYPED_TEST(DBTest, TestNumRecords) {
+  scoped_ptr<db::DB> db(db::GetDB(this->backend_));
+  db->Open(this->source_, db::READ);
+  EXPECT_EQ(2, db->NumRecords());
+}
+
+TYPED_TEST(DBTest, TestWrite) {
+  scoped_ptr<db::DB> db(db::GetDB(this->backend_));
+  db->Open(this->source_, db::WRITE);
+  scoped_ptr<db::Transaction> txn(db->NewTransaction());
+  txn->Put(this->Key(2), this->Value(2));
+  txn->Commit();
+  txn.reset();
+  db->Close();
+
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(cursor->valid());
+    EXPECT_EQ(this->Key(i), cursor->key());
+    EXPECT_EQ(this->Value(i), cursor->value());
+    cursor->Next();
+  }
+  EXPECT_FALSE(cursor->valid());
+}
+
+}  // namespace caffe
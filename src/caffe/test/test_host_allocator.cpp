@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <cstring>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class HostAllocatorTest : public ::testing::Test {};
+
+TEST_F(HostAllocatorTest, TestSizeClass) {
+  EXPECT_EQ(64, HostAllocator::SizeClass(1));
+  EXPECT_EQ(64, HostAllocator::SizeClass(64));
+  EXPECT_EQ(80, HostAllocator::SizeClass(65));
+  EXPECT_EQ(128, HostAllocator::SizeClass(120));
+  EXPECT_EQ(1280, HostAllocator::SizeClass(1025));
+  EXPECT_EQ(1792, HostAllocator::SizeClass(1700));
+  EXPECT_EQ(2048, HostAllocator::SizeClass(2048));
+}
+
+TEST_F(HostAllocatorTest, TestNoCache) {
+  HostAllocator allocator;
+  void* ptr = allocator.Allocate(1000);
+  EXPECT_TRUE(ptr);
+  EXPECT_EQ(1024, allocator.bytes_in_use());
+  allocator.Free(ptr);
+  EXPECT_EQ(0, allocator.bytes_in_use());
+  EXPECT_EQ(0, allocator.bytes_cached());
+  EXPECT_EQ(1024, allocator.peak_bytes_in_use());
+}
+
+TEST_F(HostAllocatorTest, TestReuse) {
+  HostAllocator allocator;
+  allocator.set_max_cached_bytes(4096);
+  void* ptr = allocator.Allocate(1000);
+  void* other = allocator.Allocate(1000);
+  allocator.Free(ptr);
+  EXPECT_EQ(1024, allocator.bytes_in_use());
+  EXPECT_EQ(1024, allocator.bytes_cached());
+  // A block of the same size class is reused.
+  EXPECT_EQ(ptr, allocator.Allocate(1010));
+  EXPECT_EQ(0, allocator.bytes_cached());
+  EXPECT_EQ(2048, allocator.peak_bytes_in_use());
+  allocator.Free(ptr);
+  allocator.Free(other);
+  EXPECT_EQ(2048, allocator.bytes_cached());
+  allocator.Trim();
+  EXPECT_EQ(0, allocator.bytes_cached());
+}
+
+TEST_F(HostAllocatorTest, TestMaxCachedBytes) {
+  HostAllocator allocator;
+  allocator.set_max_cached_bytes(1500);
+  void* ptr = allocator.Allocate(1000);
+  void* other = allocator.Allocate(1000);
+  allocator.Free(ptr);
+  allocator.Free(other);
+  EXPECT_EQ(1024, allocator.bytes_cached());
+  allocator.set_max_cached_bytes(0);
+  EXPECT_EQ(0, allocator.bytes_cached());
+}
+
+TEST_F(HostAllocatorTest, TestAlignment) {
+  HostAllocator allocator;
+  allocator.set_max_cached_bytes(1 << 20);
+  void* unaligned = allocator.Allocate(100);
+  allocator.set_alignment(256);
+  for (int i = 0; i < 10; ++i) {
+    void* ptr = allocator.Allocate(100 + i);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(ptr) % 256);
+    allocator.Free(ptr);
+  }
+  // The block allocated before the alignment changed is not cached.
+  allocator.Free(unaligned);
+  EXPECT_EQ(112, allocator.bytes_cached());
+}
+
+TEST_F(HostAllocatorTest, TestHugePages) {
+  HostAllocator allocator;
+  allocator.set_huge_pages(true);
+  const size_t kHugePageSize = 2 << 20;
+  void* ptr = allocator.Allocate(3 << 20);
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(ptr) % kHugePageSize);
+  EXPECT_EQ(2 * kHugePageSize, allocator.bytes_in_use());
+  allocator.Free(ptr);
+}
+
+TEST_F(HostAllocatorTest, TestDefaultAlignment) {
+  HostAllocator allocator;
+  EXPECT_EQ(64, allocator.alignment());
+  for (int size = 1; size < 10000; size *= 3) {
+    void* ptr = allocator.Allocate(size);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(ptr) % 64);
+    allocator.Free(ptr);
+  }
+}
+
+TEST_F(HostAllocatorTest, TestZero) {
+  HostAllocator allocator;
+  allocator.set_max_cached_bytes(1 << 20);
+  char* ptr = static_cast<char*>(allocator.Allocate(1000));
+  memset(ptr, 1, 1000);
+  allocator.Free(ptr);
+  ASSERT_EQ(ptr, allocator.Allocate(1000, true));
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(0, ptr[i]);
+  }
+  allocator.Free(ptr);
+}
+
+TEST_F(HostAllocatorTest, TestFirstTouch) {
+  HostAllocator allocator;
+  allocator.set_max_cached_bytes(16 << 20);
+  allocator.set_numa_policy(HostAllocator::FIRST_TOUCH);
+  allocator.set_huge_pages(true);
+  const int kSizes[] = {100 << 10, 3 << 20};
+  const size_t kAlignments[] = {64, 2 << 20};
+  for (int i = 0; i < 2; ++i) {
+    // Fresh blocks, then cached ones, are zeros.
+    for (int iter = 0; iter < 2; ++iter) {
+      char* ptr = static_cast<char*>(allocator.Allocate(kSizes[i], true));
+      EXPECT_EQ(0, reinterpret_cast<uintptr_t>(ptr) % kAlignments[i]);
+      for (int j = 0; j < kSizes[i]; ++j) {
+        ASSERT_EQ(0, ptr[j]);
+      }
+      memset(ptr, 1, kSizes[i]);
+      allocator.Free(ptr);
+    }
+  }
+  EXPECT_EQ(0, allocator.bytes_in_use());
+  allocator.Trim();
+}
+
+#ifdef USE_NUMA
+TEST_F(HostAllocatorTest, TestInterleave) {
+  HostAllocator allocator;
+  allocator.set_numa_policy(HostAllocator::INTERLEAVE);
+  char* ptr = static_cast<char*>(allocator.Allocate(1 << 20, true));
+  for (int i = 0; i < 1 << 20; ++i) {
+    ASSERT_EQ(0, ptr[i]);
+  }
+  allocator.Free(ptr);
+}
+#endif  // USE_NUMA
+
+}  // namespace caffe
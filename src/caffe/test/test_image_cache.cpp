@@ -0,0 +1,68 @@
+#include <string>
+
+#include "gtest/gtest.h"
+#include "opencv2/core/core.hpp"
+
+#include "caffe/common.hpp"
+#include "caffe/util/image_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ImageCacheTest : public ::testing::Test {
+ protected:
+  // An image of 10 x 10 pixels with 3 channels, so 300 bytes.
+  cv::Mat MakeImage(const uchar value) {
+    cv::Mat image(10, 10, CV_8UC3);
+    for (int h = 0; h < image.rows; ++h) {
+      for (int i = 0; i < image.cols * image.channels(); ++i) {
+        image.ptr<uchar>(h)[i] = value;
+      }
+    }
+    return image;
+  }
+};
+
+TEST_F(ImageCacheTest, TestLookup) {
+  ImageCache cache(1000);
+  cv::Mat image = MakeImage(7);
+  cv::Mat cached;
+  EXPECT_FALSE(cache.Lookup("a", &cached));
+  cache.Insert("a", image);
+  EXPECT_EQ(300, cache.size());
+  ASSERT_TRUE(cache.Lookup("a", &cached));
+  // The image is shared, not copied.
+  EXPECT_EQ(image.data, cached.data);
+  EXPECT_EQ(1, cache.hits());
+  EXPECT_EQ(1, cache.misses());
+}
+
+TEST_F(ImageCacheTest, TestEvictLeastRecentlyUsed) {
+  ImageCache cache(1000);
+  cache.Insert("a", MakeImage(1));
+  cache.Insert("b", MakeImage(2));
+  cache.Insert("c", MakeImage(3));
+  cv::Mat cached;
+  // Using a makes b the least recently used.
+  ASSERT_TRUE(cache.Lookup("a", &cached));
+  cache.Insert("d", MakeImage(4));
+  EXPECT_EQ(900, cache.size());
+  EXPECT_FALSE(cache.Lookup("b", &cached));
+  ASSERT_TRUE(cache.Lookup("a", &cached));
+  EXPECT_EQ(1, cached.ptr<uchar>(0)[0]);
+  ASSERT_TRUE(cache.Lookup("c", &cached));
+  EXPECT_EQ(3, cached.ptr<uchar>(0)[0]);
+  ASSERT_TRUE(cache.Lookup("d", &cached));
+  EXPECT_EQ(4, cached.ptr<uchar>(0)[0]);
+}
+
+TEST_F(ImageCacheTest, TestTooLarge) {
+  ImageCache cache(200);
+  cache.Insert("a", MakeImage(1));
+  EXPECT_EQ(0, cache.size());
+  cv::Mat cached;
+  EXPECT_FALSE(cache.Lookup("a", &cached));
+}
+
+}  // namespace caffe
@@ -107,6 +107,80 @@ TYPED_TEST(ImageDataLayerTest, TestResize) {
   }
 }
 
+TYPED_TEST(ImageDataLayerTest, TestReadahead) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(5);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_shuffle(false);
+  // Fewer files ahead than a batch, spread unevenly over the readers.
+  image_data_param->set_readers(2);
+  image_data_param->set_readahead(3);
+  ImageDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 5);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3);
+  EXPECT_EQ(this->blob_top_data_->height(), 360);
+  EXPECT_EQ(this->blob_top_data_->width(), 480);
+  // Go through the data three times; the files come back in order.
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(ImageDataLayerTest, TestUnreadableImage) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The third file is missing, and is replaced by the next of the batch.
+  std::ofstream outfile(this->filename_.c_str(), std::ofstream::out);
+  for (int i = 0; i < 5; ++i) {
+    outfile << (i == 2 ? "missing.jpg " : EXAMPLES_SOURCE_DIR "images/cat.jpg ")
+        << i << std::endl;
+  }
+  outfile.close();
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(5);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_shuffle(false);
+  const Dtype expected_labels[5] = {0, 1, 3, 3, 4};
+  // Without and with readers.
+  for (int readers = 0; readers < 2; ++readers) {
+    image_data_param->set_readers(readers);
+    ImageDataLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(expected_labels[i], this->blob_top_label_->cpu_data()[i]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(ImageDataLayerTest, TestShard) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(4);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_shuffle(false);
+  image_data_param->set_shard_id(0);
+  image_data_param->set_num_shards(2);
+  ImageDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  // Shard 0 of a stride split of the 5 files: files 0, 2 and 4.
+  for (int iter = 0; iter < 3; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_EQ(2 * ((iter * 4 + i) % 3), this->blob_top_label_->cpu_data()[i]);
+    }
+  }
+}
+
 TYPED_TEST(ImageDataLayerTest, TestShuffle) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
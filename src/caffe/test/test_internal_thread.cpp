@@ -2,6 +2,7 @@
 #include "gtest/gtest.h"
 
 #include "caffe/internal_thread.hpp"
+#include "caffe/util/blocking_queue.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -19,5 +20,21 @@ TEST_F(InternalThreadTest, TestStartAndExit) {
   EXPECT_FALSE(thread.is_started());
 }
 
+class BlockedThread : public InternalThread {
+ protected:
+  // Waits for an element that never comes.
+  virtual void InternalThreadEntry() { queue_.pop(); }
+
+  BlockingQueue<int> queue_;
+};
+
+TEST_F(InternalThreadTest, TestStopBlockedThread) {
+  BlockedThread thread;
+  EXPECT_TRUE(thread.StartInternalThread());
+  EXPECT_TRUE(thread.is_started());
+  EXPECT_TRUE(thread.StopInternalThread());
+  EXPECT_FALSE(thread.is_started());
+}
+
 }  // namespace caffe
 
@@ -596,6 +596,87 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  // A chain of inner products ending in a SOFTMAX_LOSS (with_loss) or a
+  // SOFTMAX output, whose blobs share their memory if share_blob_memory.
+  virtual void InitChainNet(const bool with_loss,
+      const bool share_blob_memory) {
+    string proto =
+        "name: 'ChainNetwork' "
+        "layers: { "
+        "  name: 'data' "
+        "  type: DUMMY_DATA "
+        "  dummy_data_param { "
+        "    num: 5 "
+        "    channels: 2 "
+        "    height: 3 "
+        "    width: 4 "
+        "    num: 5 "
+        "    channels: 1 "
+        "    height: 1 "
+        "    width: 1 "
+        "    data_filler { "
+        "      type: 'gaussian' "
+        "      std: 1 "
+        "    } "
+        "    data_filler { "
+        "      type: 'constant' "
+        "      value: 1 "
+        "    } "
+        "  } "
+        "  top: 'data' "
+        "  top: 'label' "
+        "} ";
+    const char* tops[] = {"data", "ip1", "ip2", "ip3", "ip4"};
+    for (int i = 1; i < 5; ++i) {
+      proto +=
+          "layers: { "
+          "  name: '" + string(tops[i]) + "' "
+          "  type: INNER_PRODUCT "
+          "  inner_product_param { "
+          "    num_output: 10 "
+          "    weight_filler { "
+          "      type: 'gaussian' "
+          "      std: 0.1 "
+          "    } "
+          "    bias_filler { "
+          "      type: 'constant' "
+          "      value: 0.1 "
+          "    } "
+          "  } "
+          "  bottom: '" + string(tops[i - 1]) + "' "
+          "  top: '" + string(tops[i]) + "' "
+          "} "
+          "layers: { "
+          "  name: 'sigmoid_" + string(tops[i]) + "' "
+          "  type: SIGMOID "
+          "  bottom: '" + string(tops[i]) + "' "
+          "  top: '" + string(tops[i]) + "' "
+          "} ";
+    }
+    if (with_loss) {
+      proto +=
+          "layers: { "
+          "  name: 'loss' "
+          "  type: SOFTMAX_LOSS "
+          "  bottom: 'ip4' "
+          "  bottom: 'label' "
+          "  top: 'loss' "
+          "} ";
+    } else {
+      proto +=
+          "layers: { "
+          "  name: 'prob' "
+          "  type: SOFTMAX "
+          "  bottom: 'ip4' "
+          "  top: 'prob' "
+          "} ";
+    }
+    if (share_blob_memory) {
+      proto += "share_blob_memory: true ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
   int seed_;
   shared_ptr<Net<Dtype> > net_;
 };
@@ -2149,4 +2230,118 @@ TYPED_TEST(NetTest, TestReshape) {
   }
 }
 
+TYPED_TEST(NetTest, TestShareBlobMemoryForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<Blob<Dtype>*> bottom;
+  const bool kWithLoss = false;
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet(kWithLoss, false);
+  shared_ptr<Net<Dtype> > unshared_net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet(kWithLoss, true);
+  // ip1 is done with when ip3 is computed, and ip2 when ip4 is.
+  EXPECT_EQ(this->net_->blob_by_name("ip1")->data().get(),
+      this->net_->blob_by_name("ip3")->data().get());
+  EXPECT_EQ(this->net_->blob_by_name("ip2")->data().get(),
+      this->net_->blob_by_name("ip4")->data().get());
+  EXPECT_NE(this->net_->blob_by_name("ip1")->data().get(),
+      this->net_->blob_by_name("ip2")->data().get());
+  for (int iter = 0; iter < 2; ++iter) {
+    // The same data is drawn for both nets.
+    Caffe::set_random_seed(this->seed_ + iter);
+    const vector<Blob<Dtype>*>& expected = unshared_net->Forward(bottom);
+    Caffe::set_random_seed(this->seed_ + iter);
+    const vector<Blob<Dtype>*>& output = this->net_->Forward(bottom);
+    ASSERT_EQ(expected[0]->count(), output[0]->count());
+    for (int i = 0; i < expected[0]->count(); ++i) {
+      EXPECT_EQ(expected[0]->cpu_data()[i], output[0]->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestShareBlobMemoryBackward) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<Blob<Dtype>*> bottom;
+  const bool kWithLoss = true;
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet(kWithLoss, false);
+  shared_ptr<Net<Dtype> > unshared_net = this->net_;
+  Caffe::set_random_seed(this->seed_);
+  this->InitChainNet(kWithLoss, true);
+  // The data of ip3 is no longer needed once the backward pass computes the
+  // diff of ip1.
+  EXPECT_EQ(this->net_->blob_by_name("ip1")->diff().get(),
+      this->net_->blob_by_name("ip3")->data().get());
+  const vector<shared_ptr<Blob<Dtype> > >& expected_params =
+      unshared_net->params();
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  ASSERT_EQ(expected_params.size(), params.size());
+  for (int iter = 0; iter < 2; ++iter) {
+    for (int j = 0; j < params.size(); ++j) {
+      caffe_set(expected_params[j]->count(), Dtype(0),
+          expected_params[j]->mutable_cpu_diff());
+      caffe_set(params[j]->count(), Dtype(0), params[j]->mutable_cpu_diff());
+    }
+    Caffe::set_random_seed(this->seed_ + iter);
+    const Dtype loss = unshared_net->ForwardBackward(bottom);
+    Caffe::set_random_seed(this->seed_ + iter);
+    EXPECT_EQ(loss, this->net_->ForwardBackward(bottom));
+    for (int j = 0; j < params.size(); ++j) {
+      for (int k = 0; k < params[j]->count(); ++k) {
+        EXPECT_EQ(expected_params[j]->cpu_diff()[k],
+            params[j]->cpu_diff()[k]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestForwardAllocatesNoDiff) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<Blob<Dtype>*> bottom;
+  const bool kWithLoss = false;
+  this->InitChainNet(kWithLoss, false);
+  this->net_->Forward(bottom);
+  // Without a backward pass, no diff memory is ever allocated.
+  const vector<shared_ptr<Blob<Dtype> > >& blobs = this->net_->blobs();
+  for (int i = 0; i < blobs.size(); ++i) {
+    EXPECT_FALSE(blobs[i]->has_diff());
+  }
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_FALSE(params[i]->has_diff());
+  }
+}
+
+TYPED_TEST(NetTest, TestBackwardAccumulatesParamDiffs) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<Blob<Dtype>*> bottom;
+  const bool kWithLoss = true;
+  this->InitChainNet(kWithLoss, false);
+  const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+  this->net_->ClearParamDiffs();
+  Caffe::set_random_seed(this->seed_);
+  this->net_->ForwardBackward(bottom);
+  vector<shared_ptr<Blob<Dtype> > > param_grads(params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    param_grads[i].reset(new Blob<Dtype>());
+    param_grads[i]->CopyFrom(*params[i], true, true);
+  }
+  // A second pass on the same data adds the same gradients again.
+  Caffe::set_random_seed(this->seed_);
+  this->net_->ForwardBackward(bottom);
+  const Dtype kErrorMargin = 1e-5;
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_NEAR(2 * param_grads[i]->cpu_diff()[j], params[i]->cpu_diff()[j],
+          kErrorMargin);
+    }
+  }
+  this->net_->ClearParamDiffs();
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(0, params[i]->cpu_diff()[j]);
+    }
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,49 @@
+#include <string>
+
+#include "boost/scoped_ptr.hpp"
+
+#include "caffe/util/db.hpp"
+#include "caffe/util/db_leveldb.hpp"
+#include "caffe/util/db_lmdb.hpp"
+#include "caffe/util/db_recordfile.hpp"
+
+namespace caffe { namespace db {
+
+int DB::NumRecords() {
+  boost::scoped_ptr<Cursor> cursor(NewCursor());
+  int count = 0;
+  for (cursor->SeekToFirst(); cursor->valid(); cursor->Next()) {
+    ++count;
+  }
+  return count;
+}
+
+DB* GetDB(DataParameter::DB backend) {
+  switch (backend) {
+  case DataParameter_DB_LEVELDB:
+    return new LevelDB();
+  case DataParameter_DB_LMDB:
+    return new LMDB();
+  case DataParameter_DB_RECORDFILE:
+    return new RecordFile();
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+  return NULL;
+}
+
+DB* GetDB(const string& backend) {
+  if (backend == "leveldb") {
+    return new LevelDB();
+  } else if (backend == "lmdb") {
+    return new LMDB();
+  } else if (backend == "recordfile") {
+    return new RecordFile();
+  } else {
+    LOG(FATAL) << "Unknown database backend " << backend;
+  }
+  return NULL;
+}
+
+}  // namespace db
+}  // namespace caffe
@@ -0,0 +1,65 @@
+#include <sys/stat.h>
+
+#include <string>
+
+#include "caffe/util/db_lmdb.hpp"
+
+namespace caffe { namespace db {
+
+const size_t LMDB_MAP_SIZE = 1099511627776;  // 1 TB
+
+void LMDB::Open(const string& source, Mode mode) {
+  MDB_CHECK(mdb_env_create(&mdb_env_));
+  MDB_CHECK(mdb_env_set_mapsize(mdb_env_, LMDB_MAP_SIZE));
+  if (mode == NEW) {
+    CHECK_EQ(mkdir(source.c_str(), 0744), 0) << "mkdir " << source << " failed";
+  }
+  int flags = 0;
+  if (mode == READ) {
+    // MDB_NOTLS lets the read transactions of cursors live on other threads
+    flags = MDB_RDONLY | MDB_NOTLS;
+  }
+  MDB_CHECK(mdb_env_open(mdb_env_, source.c_str(), flags, 0664));
+  MDB_txn* mdb_txn;
+  MDB_CHECK(mdb_txn_begin(mdb_env_, NULL, mode == READ ? MDB_RDONLY : 0,
+      &mdb_txn));
+  MDB_CHECK(mdb_open(mdb_txn, NULL, 0, &mdb_dbi_));
+  MDB_CHECK(mdb_txn_commit(mdb_txn));
+  LOG(INFO) << "Opened lmdb " << source;
+}
+
+LMDBCursor* LMDB::NewCursor() {
+  MDB_txn* mdb_txn;
+  MDB_cursor* mdb_cursor;
+  MDB_CHECK(mdb_txn_begin(mdb_env_, NULL, MDB_RDONLY, &mdb_txn));
+  MDB_CHECK(mdb_cursor_open(mdb_txn, mdb_dbi_, &mdb_cursor));
+  return new LMDBCursor(mdb_txn, mdb_cursor);
+}
+
+int LMDB::NumRecords() {
+  MDB_txn* mdb_txn;
+  MDB_stat db_stat;
+  MDB_CHECK(mdb_txn_begin(mdb_env_, NULL, MDB_RDONLY, &mdb_txn));
+  const int mdb_status = mdb_stat(mdb_txn, mdb_dbi_, &db_stat);
+  mdb_txn_abort(mdb_txn);
+  MDB_CHECK(mdb_status);
+  return db_stat.ms_entries;
+}
+
+LMDBTransaction* LMDB::NewTransaction() {
+  MDB_txn* mdb_txn;
+  MDB_CHECK(mdb_txn_begin(mdb_env_, NULL, 0, &mdb_txn));
+  return new LMDBTransaction(&mdb_dbi_, mdb_txn);
+}
+
+void LMDBTransaction::Put(const string& key, const string& value) {
+  MDB_val mdb_key, mdb_value;
+  mdb_key.mv_data = const_cast<char*>(key.data());
+  mdb_key.mv_size = key.size();
+  mdb_value.mv_data = const_cast<char*>(value.data());
+  mdb_value.mv_size = value.size();
+  MDB_CHECK(mdb_put(mdb_txn_, *mdb_dbi_, &mdb_key, &mdb_value, 0));
+}
+
+}  // namespace db
+}  // namespace caffe
@@ -0,0 +1,181 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/util/db_recordfile.hpp"
+
+namespace caffe { namespace db {
+
+static const char RECORDFILE_MAGIC[8] =
+    {'C', 'A', 'F', 'F', 'E', 'R', 'E', 'C'};
+static const size_t RECORDFILE_FOOTER_SIZE = 2 * sizeof(uint64_t) + 8;
+
+// Checks the footer at the end of a file of file_size bytes and returns the
+// offset of the index and the number of records.
+static void ParseFooter(const char* footer, uint64_t file_size,
+    const string& source, uint64_t* index_offset, uint64_t* count) {
+  CHECK_EQ(memcmp(footer + 2 * sizeof(uint64_t), RECORDFILE_MAGIC, 8), 0)
+      << source << " is not a record file";
+  memcpy(index_offset, footer, sizeof(uint64_t));
+  memcpy(count, footer + sizeof(uint64_t), sizeof(uint64_t));
+  CHECK_EQ(*index_offset + *count * sizeof(uint64_t) + RECORDFILE_FOOTER_SIZE,
+      file_size) << source << " is truncated";
+}
+
+static uint32_t ReadSize(const char* data) {
+  uint32_t size;
+  memcpy(&size, data, sizeof(size));
+  return size;
+}
+
+static string ReadKey(const char* record) {
+  return string(record + sizeof(uint32_t), ReadSize(record));
+}
+
+string RecordFileCursor::key() {
+  return ReadKey(data_ + (*offsets_)[pos_]);
+}
+
+string RecordFileCursor::value() {
+  const char* record = data_ + (*offsets_)[pos_];
+  record += sizeof(uint32_t) + ReadSize(record);
+  return string(record + sizeof(uint32_t), ReadSize(record));
+}
+
+void RecordFileCursor::Seek(const string& key) {
+  pos_ = db_->Find(key);
+}
+
+void RecordFileTransaction::Commit() {
+  for (int i = 0; i < records_.size(); ++i) {
+    db_->Append(records_[i].first, records_[i].second);
+  }
+  records_.clear();
+  CHECK_EQ(fflush(db_->file_), 0) << "Failed to write " << db_->source_;
+}
+
+void RecordFile::Open(const string& source, Mode mode) {
+  source_ = source;
+  struct stat file_stat;
+  bool exists = stat(source.c_str(), &file_stat) == 0;
+  if (mode == READ) {
+    CHECK(exists) << "Failed to open record file " << source;
+    CHECK_GE(file_stat.st_size, RECORDFILE_FOOTER_SIZE)
+        << source << " is not a record file";
+    int fd = open(source.c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "Failed to open record file " << source;
+    map_size_ = file_stat.st_size;
+    void* map = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK(map != MAP_FAILED) << "Failed to map record file " << source;
+    map_ = static_cast<char*>(map);
+    uint64_t index_offset, count;
+    ParseFooter(map_ + map_size_ - RECORDFILE_FOOTER_SIZE, map_size_, source,
+        &index_offset, &count);
+    // The records have arbitrary sizes, so the index may be unaligned.
+    offsets_.resize(count);
+    if (count > 0) {
+      memcpy(&offsets_[0], map_ + index_offset, count * sizeof(uint64_t));
+    }
+    LOG(INFO) << "Opened record file " << source << " with " << count
+              << " records";
+    return;
+  }
+  CHECK(mode != NEW || !exists) << "Record file " << source
+                                << " already exists";
+  offsets_.clear();
+  end_ = 0;
+  if (exists) {
+    file_ = fopen(source.c_str(), "r+b");
+    CHECK(file_) << "Failed to open record file " << source;
+    char footer[RECORDFILE_FOOTER_SIZE];
+    CHECK_EQ(fseeko(file_, -static_cast<off_t>(RECORDFILE_FOOTER_SIZE),
+        SEEK_END), 0) << source << " is not a record file";
+    CHECK_EQ(fread(footer, 1, RECORDFILE_FOOTER_SIZE, file_),
+        RECORDFILE_FOOTER_SIZE) << "Failed to read " << source;
+    uint64_t count;
+    ParseFooter(footer, file_stat.st_size, source, &end_, &count);
+    offsets_.resize(count);
+    CHECK_EQ(fseeko(file_, end_, SEEK_SET), 0);
+    if (count > 0) {
+      CHECK_EQ(fread(&offsets_[0], sizeof(uint64_t), count, file_), count)
+          << "Failed to read " << source;
+    }
+    // New records overwrite the index, which is written again on Close.
+    CHECK_EQ(fseeko(file_, end_, SEEK_SET), 0);
+  } else {
+    file_ = fopen(source.c_str(), "wb");
+    CHECK(file_) << "Failed to create record file " << source;
+  }
+  LOG(INFO) << "Opened record file " << source << " for writing";
+}
+
+void RecordFile::Close() {
+  if (map_ != NULL) {
+    munmap(map_, map_size_);
+    map_ = NULL;
+    map_size_ = 0;
+    positions_.clear();
+  }
+  if (file_ != NULL) {
+    char footer[RECORDFILE_FOOTER_SIZE];
+    uint64_t count = offsets_.size();
+    memcpy(footer, &end_, sizeof(uint64_t));
+    memcpy(footer + sizeof(uint64_t), &count, sizeof(uint64_t));
+    memcpy(footer + 2 * sizeof(uint64_t), RECORDFILE_MAGIC, 8);
+    if (count > 0) {
+      CHECK_EQ(fwrite(&offsets_[0], sizeof(uint64_t), count, file_), count)
+          << "Failed to write " << source_;
+    }
+    CHECK_EQ(fwrite(footer, 1, RECORDFILE_FOOTER_SIZE, file_),
+        RECORDFILE_FOOTER_SIZE) << "Failed to write " << source_;
+    CHECK_EQ(fclose(file_), 0) << "Failed to write " << source_;
+    file_ = NULL;
+  }
+  offsets_.clear();
+}
+
+RecordFileCursor* RecordFile::NewCursor() {
+  CHECK(map_) << "Record file " << source_ << " is not open for reading";
+  return new RecordFileCursor(this, map_, &offsets_);
+}
+
+size_t RecordFile::Find(const string& key) {
+  CHECK(map_) << "Record file " << source_ << " is not open for reading";
+  boost::mutex::scoped_lock lock(positions_mutex_);
+  if (positions_.empty()) {
+    for (size_t i = 0; i < offsets_.size(); ++i) {
+      positions_.insert(std::make_pair(ReadKey(map_ + offsets_[i]), i));
+    }
+  }
+  std::map<string, size_t>::const_iterator it = positions_.find(key);
+  return it == positions_.end() ? offsets_.size() : it->second;
+}
+
+RecordFileTransaction* RecordFile::NewTransaction() {
+  CHECK(file_) << "Record file " << source_ << " is not open for writing";
+  return new RecordFileTransaction(this);
+}
+
+void RecordFile::Append(const string& key, const string& value) {
+  uint32_t key_size = key.size();
+  uint32_t value_size = value.size();
+  CHECK_EQ(key_size, key.size()) << "Record key too large";
+  CHECK_EQ(value_size, value.size()) << "Record value too large";
+  CHECK_EQ(fwrite(&key_size, sizeof(key_size), 1, file_), 1);
+  CHECK_EQ(fwrite(key.data(), 1, key_size, file_), key_size);
+  CHECK_EQ(fwrite(&value_size, sizeof(value_size), 1, file_), 1);
+  CHECK_EQ(fwrite(value.data(), 1, value_size, file_), value_size);
+  offsets_.push_back(end_);
+  end_ += 2 * sizeof(uint32_t) + key_size + value_size;
+}
+
+}  // namespace db
+}  // namespace caffe
@@ -0,0 +1,295 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "boost/scoped_ptr.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/weak_ptr.hpp"
+
+#include "caffe/util/db.hpp"
+#include "caffe/util/flat_dataset.hpp"
+#include "caffe/util/io.hpp"
+
+namespace caffe {
+
+static const char FLAT_DATASET_MAGIC[8] =
+    {'C', 'A', 'F', 'F', 'E', 'F', 'L', 'T'};
+static const uint32_t FLAT_DATASET_VERSION = 1;
+static const uint32_t FLAT_DATASET_HAS_INDEX = 1;
+
+// The header as laid out at the start of the file.
+struct FlatDatasetHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t data_type;
+  uint64_t num;
+  uint32_t channels;
+  uint32_t height;
+  uint32_t width;
+  uint32_t flags;
+  uint64_t labels_offset;
+  uint64_t index_offset;
+  char reserved[8];
+};
+
+const size_t FlatDataset::kHeaderSize;
+
+static size_t DataTypeSize(FlatDataset::DataType data_type) {
+  return data_type == FlatDataset::UINT8 ? sizeof(uint8_t) : sizeof(float);
+}
+
+// Rounds offset up to a multiple of 8 so the labels and the index that follow
+// the records are aligned.
+static uint64_t Align8(uint64_t offset) {
+  return (offset + 7) & ~static_cast<uint64_t>(7);
+}
+
+FlatDataset::FlatDataset()
+    : map_(NULL), map_size_(0), records_(NULL), num_(0), channels_(0),
+      height_(0), width_(0), data_type_(UINT8), record_size_(0),
+      labels_(NULL), index_(NULL) {
+  CHECK_EQ(sizeof(FlatDatasetHeader), kHeaderSize);
+}
+
+void FlatDataset::Open(const string& source) {
+  CHECK(!records_) << "FlatDataset " << source_ << " is already open";
+  source_ = source;
+  int fd = open(source.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Failed to open flat dataset " << source;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << "Failed to stat " << source;
+  CHECK_GE(file_stat.st_size, kHeaderSize) << source
+      << " is not a flat dataset";
+  map_size_ = file_stat.st_size;
+  void* map = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(map != MAP_FAILED) << "Failed to map flat dataset " << source;
+  map_ = static_cast<char*>(map);
+  records_ = map_ + kHeaderSize;
+
+  FlatDatasetHeader header;
+  memcpy(&header, map_, kHeaderSize);
+  CHECK_EQ(memcmp(header.magic, FLAT_DATASET_MAGIC, 8), 0)
+      << source << " is not a flat dataset";
+  CHECK_EQ(header.version, FLAT_DATASET_VERSION)
+      << "Unsupported flat dataset version in " << source;
+  CHECK(header.data_type == UINT8 || header.data_type == FLOAT)
+      << "Unknown data type in " << source;
+  data_type_ = static_cast<DataType>(header.data_type);
+  num_ = header.num;
+  channels_ = header.channels;
+  height_ = header.height;
+  width_ = header.width;
+  record_size_ = channels_ * height_ * width_ * DataTypeSize(data_type_);
+  CHECK_LE(header.labels_offset + num_ * sizeof(int32_t), map_size_)
+      << source << " is truncated";
+  labels_ = reinterpret_cast<const int32_t*>(map_ + header.labels_offset);
+  if (header.flags & FLAT_DATASET_HAS_INDEX) {
+    CHECK_LE(header.index_offset + num_ * sizeof(uint64_t), map_size_)
+        << source << " is truncated";
+    index_ = reinterpret_cast<const uint64_t*>(map_ + header.index_offset);
+  } else {
+    CHECK_LE(kHeaderSize + num_ * record_size_, header.labels_offset)
+        << source << " is truncated";
+    index_ = NULL;
+  }
+  LOG(INFO) << "Opened flat dataset " << source << " of " << num_ << " "
+      << (data_type_ == UINT8 ? "uint8" : "float") << " records of "
+      << channels_ << "," << height_ << "," << width_;
+}
+
+void FlatDataset::Load(const string& source, DataParameter_DB backend) {
+  CHECK(!records_) << "FlatDataset " << source_ << " is already open";
+  source_ = source;
+  boost::scoped_ptr<db::DB> db(db::GetDB(backend));
+  db->Open(source, db::READ);
+  boost::scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  Datum datum;
+  for (; cursor->valid(); cursor->Next()) {
+    datum.ParseFromString(cursor->value());
+    if (datum.encoded()) {
+      // The records after the first are decoded to its channels.
+      const bool decoded = arena_labels_.empty() ? DecodeDatum(&datum) :
+          DecodeDatum(&datum, channels_ != 1);
+      CHECK(decoded) << "Could not decode datum";
+    }
+    if (arena_labels_.empty()) {
+      channels_ = datum.channels();
+      height_ = datum.height();
+      width_ = datum.width();
+      data_type_ = datum.data().size() ? UINT8 : FLOAT;
+      record_size_ = channels_ * height_ * width_ * DataTypeSize(data_type_);
+    } else {
+      CHECK_EQ(datum.channels(), channels_) << "Datums must have one shape";
+      CHECK_EQ(datum.height(), height_) << "Datums must have one shape";
+      CHECK_EQ(datum.width(), width_) << "Datums must have one shape";
+    }
+    const char* data;
+    if (data_type_ == UINT8) {
+      data = datum.data().data();
+      CHECK_EQ(datum.data().size(), record_size_) << "Incorrect data size";
+    } else {
+      data = reinterpret_cast<const char*>(datum.float_data().data());
+      CHECK_EQ(datum.float_data_size() * sizeof(float), record_size_)
+          << "Incorrect data size";
+    }
+    arena_.insert(arena_.end(), data, data + record_size_);
+    arena_labels_.push_back(datum.label());
+  }
+  CHECK(!arena_labels_.empty()) << "Empty database " << source;
+  num_ = arena_labels_.size();
+  records_ = &arena_[0];
+  labels_ = &arena_labels_[0];
+  index_ = NULL;
+  LOG(INFO) << "Loaded " << num_ << " records of " << channels_ << ","
+      << height_ << "," << width_ << " from " << source << " in "
+      << arena_.size() / 1048576 << " MB of memory";
+}
+
+void FlatDataset::Close() {
+  if (map_ != NULL) {
+    munmap(map_, map_size_);
+    map_ = NULL;
+    map_size_ = 0;
+  }
+  vector<char>().swap(arena_);
+  vector<int32_t>().swap(arena_labels_);
+  records_ = NULL;
+  labels_ = NULL;
+  index_ = NULL;
+  num_ = 0;
+}
+
+static boost::mutex loaded_datasets_mutex;
+
+shared_ptr<FlatDataset> FlatDataset::LoadShared(const string& source,
+    DataParameter_DB backend) {
+  static std::map<std::pair<string, int>, boost::weak_ptr<FlatDataset> >
+      loaded_datasets;
+  boost::mutex::scoped_lock lock(loaded_datasets_mutex);
+  boost::weak_ptr<FlatDataset>& loaded =
+      loaded_datasets[std::make_pair(source, static_cast<int>(backend))];
+  shared_ptr<FlatDataset> dataset = loaded.lock();
+  if (!dataset) {
+    dataset.reset(new FlatDataset());
+    dataset->Load(source, backend);
+    loaded = dataset;
+  } else {
+    LOG(INFO) << "Sharing the records of " << source << " loaded in memory";
+  }
+  return dataset;
+}
+
+void FlatDatasetWriter::Open(const string& filename,
+    FlatDataset::DataType data_type, bool write_index) {
+  CHECK(!file_) << "FlatDatasetWriter " << filename_ << " is already open";
+  filename_ = filename;
+  data_type_ = data_type;
+  write_index_ = write_index;
+  channels_ = height_ = width_ = 0;
+  labels_.clear();
+  struct stat file_stat;
+  CHECK_NE(stat(filename.c_str(), &file_stat), 0) << "Flat dataset "
+      << filename << " already exists";
+  file_ = fopen(filename.c_str(), "wb");
+  CHECK(file_) << "Failed to create flat dataset " << filename;
+  // Reserve the header, which is written on Close once num is known.
+  WriteHeader();
+}
+
+void FlatDatasetWriter::Write(const Datum& datum) {
+  CHECK(file_) << "FlatDatasetWriter is not open";
+  if (labels_.empty()) {
+    channels_ = datum.channels();
+    height_ = datum.height();
+    width_ = datum.width();
+  } else {
+    CHECK_EQ(datum.channels(), channels_) << "Datums must have the same shape";
+    CHECK_EQ(datum.height(), height_) << "Datums must have the same shape";
+    CHECK_EQ(datum.width(), width_) << "Datums must have the same shape";
+  }
+  const int size = channels_ * height_ * width_;
+  const string& data = datum.data();
+  if (data_type_ == FlatDataset::UINT8) {
+    CHECK_EQ(data.size(), size) << "Only datums with uint8 data can be "
+        << "stored in a uint8 flat dataset";
+    CHECK_EQ(fwrite(data.data(), 1, size, file_), size)
+        << "Failed to write " << filename_;
+  } else {
+    float_buffer_.resize(size);
+    if (data.size()) {
+      CHECK_EQ(data.size(), size) << "Incorrect data field size";
+      for (int i = 0; i < size; ++i) {
+        float_buffer_[i] = static_cast<uint8_t>(data[i]);
+      }
+    } else {
+      CHECK_EQ(datum.float_data_size(), size) << "Incorrect data field size";
+      memcpy(&float_buffer_[0], datum.float_data().data(),
+          size * sizeof(float));
+    }
+    CHECK_EQ(fwrite(&float_buffer_[0], sizeof(float), size, file_), size)
+        << "Failed to write " << filename_;
+  }
+  labels_.push_back(datum.label());
+}
+
+void FlatDatasetWriter::Close() {
+  if (file_ == NULL) {
+    return;
+  }
+  const uint64_t num = labels_.size();
+  const uint64_t record_size =
+      channels_ * height_ * width_ * DataTypeSize(data_type_);
+  const char padding[8] = {0};
+  uint64_t offset = FlatDataset::kHeaderSize + num * record_size;
+  CHECK_EQ(fwrite(padding, 1, Align8(offset) - offset, file_),
+      Align8(offset) - offset);
+  offset = Align8(offset);
+  if (num > 0) {
+    CHECK_EQ(fwrite(&labels_[0], sizeof(int32_t), num, file_), num)
+        << "Failed to write " << filename_;
+  }
+  offset += num * sizeof(int32_t);
+  CHECK_EQ(fwrite(padding, 1, Align8(offset) - offset, file_),
+      Align8(offset) - offset);
+  for (uint64_t i = 0; write_index_ && i < num; ++i) {
+    uint64_t record_offset = FlatDataset::kHeaderSize + i * record_size;
+    CHECK_EQ(fwrite(&record_offset, sizeof(record_offset), 1, file_), 1)
+        << "Failed to write " << filename_;
+  }
+  CHECK_EQ(fseek(file_, 0, SEEK_SET), 0);
+  WriteHeader();
+  CHECK_EQ(fclose(file_), 0) << "Failed to write " << filename_;
+  file_ = NULL;
+  LOG(INFO) << "Wrote " << num << " records to " << filename_;
+}
+
+void FlatDatasetWriter::WriteHeader() {
+  FlatDatasetHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FLAT_DATASET_MAGIC, 8);
+  header.version = FLAT_DATASET_VERSION;
+  header.data_type = data_type_;
+  header.num = labels_.size();
+  header.channels = channels_;
+  header.height = height_;
+  header.width = width_;
+  const uint64_t records_end = FlatDataset::kHeaderSize + header.num
+      * channels_ * height_ * width_ * DataTypeSize(data_type_);
+  header.labels_offset = Align8(records_end);
+  if (write_index_) {
+    header.flags = FLAT_DATASET_HAS_INDEX;
+    header.index_offset =
+        Align8(header.labels_offset + header.num * sizeof(int32_t));
+  }
+  CHECK_EQ(fwrite(&header, sizeof(header), 1, file_), 1)
+      << "Failed to write " << filename_;
+}
+
+}  // namespace caffe
@@ -0,0 +1,308 @@
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <boost/thread.hpp>
+#ifdef USE_NUMA
+#include <numa.h>
+#endif
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "caffe/util/host_allocator.hpp"
+
+namespace caffe {
+
+static const size_t kMinBlockSize = 64;
+static const size_t kCacheLineSize = 64;
+static const size_t kHugePageSize = 2 << 20;
+// The blocks of at least this size are mapped from the system rather than
+// malloc'ed under the FIRST_TOUCH and INTERLEAVE policies.
+static const size_t kMinMappedSize = 64 << 10;
+
+// A block of host memory: mapped blocks come from mmap, the others from
+// malloc or posix_memalign.
+struct HostBlock {
+  HostBlock() : ptr(NULL), bytes(0), generation(0), mapped(false) {}
+
+  void* ptr;
+  size_t bytes;
+  int generation;
+  bool mapped;
+};
+
+class HostAllocator::Blocks {
+ public:
+  Blocks()
+      : alignment_(kCacheLineSize), huge_pages_(false),
+        numa_policy_(HostAllocator::LOCAL), max_cached_bytes_(0),
+        generation_(0), bytes_in_use_(0), peak_bytes_in_use_(0),
+        bytes_cached_(0) {}
+
+  // The size of the blocks allocated for size bytes with the settings.
+  size_t BlockSize(const size_t size) const {
+    const size_t bytes = SizeClass(size);
+    if (huge_pages_ && bytes >= kHugePageSize) {
+      return (bytes + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    }
+    return bytes;
+  }
+
+  HostBlock SystemAllocate(const size_t bytes) const {
+    HostBlock block;
+    block.bytes = bytes;
+    block.generation = generation_;
+    const size_t alignment = huge_pages_ && bytes >= kHugePageSize ?
+        kHugePageSize : alignment_;
+    if (numa_policy_ != HostAllocator::LOCAL && bytes >= kMinMappedSize) {
+      block.ptr = Map(bytes, alignment);
+      block.mapped = true;
+    } else if (alignment > 0) {
+      CHECK_EQ(0, posix_memalign(&block.ptr, alignment, bytes))
+          << "Could not allocate " << bytes << " bytes of host memory";
+    } else {
+      block.ptr = malloc(bytes);
+      CHECK(block.ptr) << "Could not allocate " << bytes
+          << " bytes of host memory";
+    }
+#ifdef MADV_HUGEPAGE
+    if (alignment == kHugePageSize) {
+      // Only a hint: without transparent huge pages, the pages stay small.
+      madvise(block.ptr, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    return block;
+  }
+
+  // Maps bytes of zeros that no thread has touched yet, so that each page
+  // is placed by the NUMA policy when it is first written.
+  void* Map(const size_t bytes, const size_t alignment) const {
+    // The mappings are page aligned: to align the block further, map the
+    // extra bytes needed and unmap them around the block.
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t length = (bytes + page_size - 1) / page_size * page_size;
+    const size_t extra = alignment > page_size ? alignment : 0;
+    void* mapping = mmap(NULL, length + extra, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(mapping != MAP_FAILED) << "Could not map " << bytes
+        << " bytes of host memory";
+    char* begin = static_cast<char*>(mapping);
+    char* ptr = begin;
+    if (extra > 0) {
+      char* end = begin + length + extra;
+      ptr = reinterpret_cast<char*>(
+          (reinterpret_cast<uintptr_t>(begin) + alignment - 1) /
+          alignment * alignment);
+      if (ptr > begin) {
+        munmap(begin, ptr - begin);
+      }
+      if (end > ptr + length) {
+        munmap(ptr + length, end - (ptr + length));
+      }
+    }
+#ifdef USE_NUMA
+    if (numa_policy_ == HostAllocator::INTERLEAVE) {
+      numa_interleave_memory(ptr, bytes, numa_all_nodes_ptr);
+    }
+#endif
+    return ptr;
+  }
+
+  static void Release(const HostBlock& block) {
+    if (block.mapped) {
+      munmap(block.ptr, block.bytes);
+    } else {
+      free(block.ptr);
+    }
+  }
+
+  void Trim() {
+    for (std::map<size_t, std::vector<HostBlock> >::iterator it =
+         free_.begin(); it != free_.end(); ++it) {
+      for (int i = 0; i < it->second.size(); ++i) {
+        Release(it->second[i]);
+      }
+    }
+    free_.clear();
+    bytes_cached_ = 0;
+  }
+
+  // Called with the mutex held when the alignment, huge pages or NUMA
+  // policy change, so that the blocks allocated before are not handed out
+  // again.
+  void SettingsChanged() {
+    ++generation_;
+    Trim();
+  }
+
+  mutable boost::mutex mutex_;
+  size_t alignment_;
+  bool huge_pages_;
+  HostAllocator::NumaPolicy numa_policy_;
+  size_t max_cached_bytes_;
+  // Incremented when the alignment, huge pages or NUMA policy change.
+  int generation_;
+  // The free blocks cached by size, and the blocks in use.
+  std::map<size_t, std::vector<HostBlock> > free_;
+  std::map<void*, HostBlock> in_use_;
+  size_t bytes_in_use_;
+  size_t peak_bytes_in_use_;
+  size_t bytes_cached_;
+};
+
+HostAllocator::HostAllocator() : blocks_(new Blocks()) {
+}
+
+HostAllocator::~HostAllocator() {
+  Trim();
+}
+
+HostAllocator& HostAllocator::Get() {
+  static HostAllocator* allocator = new HostAllocator();
+  return *allocator;
+}
+
+size_t HostAllocator::SizeClass(const size_t size) {
+  if (size <= kMinBlockSize) {
+    return kMinBlockSize;
+  }
+  // Round up to a quarter of the power of two below size.
+  size_t power = kMinBlockSize;
+  while (power * 2 < size) {
+    power *= 2;
+  }
+  const size_t quarter = power / 4;
+  return (size + quarter - 1) / quarter * quarter;
+}
+
+void* HostAllocator::Allocate(const size_t size, const bool zero) {
+  HostBlock block;
+  // A block freshly mapped is zeros already, and is left untouched for its
+  // pages to be placed by the threads that first write them.
+  bool fresh_mapping = false;
+  {
+    boost::mutex::scoped_lock lock(blocks_->mutex_);
+    const size_t bytes = blocks_->BlockSize(size);
+    std::vector<HostBlock>& cached = blocks_->free_[bytes];
+    if (cached.size() > 0) {
+      block = cached.back();
+      cached.pop_back();
+      blocks_->bytes_cached_ -= bytes;
+    } else {
+      block = blocks_->SystemAllocate(bytes);
+      fresh_mapping = block.mapped;
+    }
+    blocks_->in_use_[block.ptr] = block;
+    blocks_->bytes_in_use_ += bytes;
+    blocks_->peak_bytes_in_use_ =
+        std::max(blocks_->peak_bytes_in_use_, blocks_->bytes_in_use_);
+  }
+  if (zero && !fresh_mapping) {
+    memset(block.ptr, 0, size);
+  }
+  return block.ptr;
+}
+
+void HostAllocator::Free(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  std::map<void*, HostBlock>::iterator it = blocks_->in_use_.find(ptr);
+  CHECK(it != blocks_->in_use_.end())
+      << "Freeing host memory that was not allocated by this allocator";
+  const HostBlock block = it->second;
+  const bool cache = block.generation == blocks_->generation_ &&
+      blocks_->bytes_cached_ + block.bytes <= blocks_->max_cached_bytes_;
+  blocks_->in_use_.erase(it);
+  blocks_->bytes_in_use_ -= block.bytes;
+  if (cache) {
+    blocks_->free_[block.bytes].push_back(block);
+    blocks_->bytes_cached_ += block.bytes;
+  } else {
+    Blocks::Release(block);
+  }
+}
+
+void HostAllocator::Trim() {
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  blocks_->Trim();
+}
+
+void HostAllocator::set_alignment(const size_t alignment) {
+  CHECK(alignment == 0 || (alignment % sizeof(void*) == 0 &&
+      (alignment & (alignment - 1)) == 0))
+      << "The alignment must be a power of two multiple of "
+      << sizeof(void*);
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  blocks_->alignment_ = alignment;
+  blocks_->SettingsChanged();
+}
+
+size_t HostAllocator::alignment() const {
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  return blocks_->alignment_;
+}
+
+void HostAllocator::set_huge_pages(const bool huge_pages) {
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  blocks_->huge_pages_ = huge_pages;
+  blocks_->SettingsChanged();
+}
+
+bool HostAllocator::huge_pages() const {
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  return blocks_->huge_pages_;
+}
+
+void HostAllocator::set_numa_policy(const NumaPolicy numa_policy) {
+  if (numa_policy == INTERLEAVE) {
+#ifdef USE_NUMA
+    CHECK_GE(numa_available(), 0) << "NUMA is not available on this system";
+#else
+    LOG(FATAL) << "Interleaving host memory requires Caffe built with "
+        << "USE_NUMA";
+#endif
+  }
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  blocks_->numa_policy_ = numa_policy;
+  blocks_->SettingsChanged();
+}
+
+HostAllocator::NumaPolicy HostAllocator::numa_policy() const {
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  return blocks_->numa_policy_;
+}
+
+void HostAllocator::set_max_cached_bytes(const size_t max_cached_bytes) {
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  blocks_->max_cached_bytes_ = max_cached_bytes;
+  if (blocks_->bytes_cached_ > max_cached_bytes) {
+    blocks_->Trim();
+  }
+}
+
+size_t HostAllocator::max_cached_bytes() const {
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  return blocks_->max_cached_bytes_;
+}
+
+size_t HostAllocator::bytes_in_use() const {
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  return blocks_->bytes_in_use_;
+}
+
+size_t HostAllocator::peak_bytes_in_use() const {
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  return blocks_->peak_bytes_in_use_;
+}
+
+size_t HostAllocator::bytes_cached() const {
+  boost::mutex::scoped_lock lock(blocks_->mutex_);
+  return blocks_->bytes_cached_;
+}
+
+}  // namespace caffe
@@ -0,0 +1,103 @@
+#include <boost/thread.hpp>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "caffe/util/image_cache.hpp"
+
+namespace caffe {
+
+static size_t ImageBytes(const cv::Mat& image) {
+  return image.total() * image.elemSize();
+}
+
+class ImageCache::Entries {
+ public:
+  typedef std::list<std::pair<string, cv::Mat> > List;
+
+  Entries() : size_(0), hits_(0), misses_(0) {}
+
+  mutable boost::mutex mutex_;
+  // The images from the most to the least recently used, and the position
+  // of each key in the list.
+  List lru_;
+  std::map<string, List::iterator> index_;
+  size_t size_;
+  size_t hits_;
+  size_t misses_;
+};
+
+ImageCache::ImageCache(const size_t capacity)
+    : capacity_(capacity), entries_(new Entries()) {
+}
+
+cv::Mat ImageCache::Get(const string& filename, const int flags) {
+  cv::Mat image;
+  if (Lookup(filename, &image)) {
+    return image;
+  }
+  // Decode without holding the lock, so that the other threads can use the
+  // cache meanwhile.
+  image = cv::imread(filename, flags);
+  if (image.data) {
+    Insert(filename, image);
+  }
+  return image;
+}
+
+bool ImageCache::Lookup(const string& key, cv::Mat* image) {
+  boost::mutex::scoped_lock lock(entries_->mutex_);
+  std::map<string, Entries::List::iterator>::iterator it =
+      entries_->index_.find(key);
+  if (it == entries_->index_.end()) {
+    ++entries_->misses_;
+    return false;
+  }
+  ++entries_->hits_;
+  // Move the entry to the front of the list.
+  entries_->lru_.splice(entries_->lru_.begin(), entries_->lru_, it->second);
+  *image = it->second->second;
+  return true;
+}
+
+void ImageCache::Insert(const string& key, const cv::Mat& image) {
+  const size_t bytes = ImageBytes(image);
+  if (bytes > capacity_) {
+    return;
+  }
+  boost::mutex::scoped_lock lock(entries_->mutex_);
+  if (entries_->index_.count(key)) {
+    // Another thread decoded it first.
+    return;
+  }
+  while (entries_->size_ + bytes > capacity_) {
+    const Entries::List::value_type& lru = entries_->lru_.back();
+    entries_->size_ -= ImageBytes(lru.second);
+    entries_->index_.erase(lru.first);
+    entries_->lru_.pop_back();
+  }
+  entries_->lru_.push_front(std::make_pair(key, image));
+  entries_->index_[key] = entries_->lru_.begin();
+  entries_->size_ += bytes;
+}
+
+size_t ImageCache::size() const {
+  boost::mutex::scoped_lock lock(entries_->mutex_);
+  return entries_->size_;
+}
+
+size_t ImageCache::hits() const {
+  boost::mutex::scoped_lock lock(entries_->mutex_);
+  return entries_->hits_;
+}
+
+size_t ImageCache::misses() const {
+  boost::mutex::scoped_lock lock(entries_->mutex_);
+  return entries_->misses_;
+}
+
+}  // namespace caffe
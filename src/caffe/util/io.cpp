@@ -1,3 +1,4 @@
+#include <boost/thread/recursive_mutex.hpp>
 #include <fcntl.h>
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
@@ -66,32 +67,62 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
   CHECK(proto.SerializeToOstream(&output));
 }
 
-bool ReadImageToDatum(const string& filename, const int label,
-    const int height, const int width, const bool is_color, Datum* datum) {
-  cv::Mat cv_img;
+// Resizes the image to height x width unless they are 0.
+static cv::Mat ResizeCVMat(const cv::Mat& cv_img_origin, const int height,
+    const int width) {
+  if (height > 0 && width > 0) {
+    cv::Mat cv_img;
+    cv::resize(cv_img_origin, cv_img, cv::Size(width, height));
+    return cv_img;
+  }
+  return cv_img_origin;
+}
+
+cv::Mat ReadImageToCVMat(const string& filename,
+    const int height, const int width, const bool is_color) {
   int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
     CV_LOAD_IMAGE_GRAYSCALE);
 
   cv::Mat cv_img_origin = cv::imread(filename, cv_read_flag);
   if (!cv_img_origin.data) {
     LOG(ERROR) << "Could not open or find file " << filename;
-    return false;
+    return cv_img_origin;
   }
-  if (height > 0 && width > 0) {
-    cv::resize(cv_img_origin, cv_img, cv::Size(width, height));
-  } else {
-    cv_img = cv_img_origin;
+  return ResizeCVMat(cv_img_origin, height, width);
+}
+
+cv::Mat DecodeImageToCVMat(const string& data,
+    const int height, const int width, const bool is_color) {
+  // The readers leave the data of a file they could not read empty, which
+  // imdecode does not accept.
+  if (data.empty()) {
+    return cv::Mat();
+  }
+  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
+    CV_LOAD_IMAGE_GRAYSCALE);
+  // imdecode reads the buffer in place.
+  cv::Mat buf(1, data.size(), CV_8UC1, const_cast<char*>(data.data()));
+  cv::Mat cv_img_origin = cv::imdecode(buf, cv_read_flag);
+  if (!cv_img_origin.data) {
+    return cv_img_origin;
   }
+  return ResizeCVMat(cv_img_origin, height, width);
+}
 
-  int num_channels = (is_color ? 3 : 1);
+// Stores the pixels of a decoded 8-bit image in the data of the datum,
+// channel by channel.
+static void CVMatToDatum(const cv::Mat& cv_img, Datum* datum) {
+  const int num_channels = cv_img.channels();
+  CHECK(num_channels == 1 || num_channels == 3) << "Unsupported image channels";
   datum->set_channels(num_channels);
   datum->set_height(cv_img.rows);
   datum->set_width(cv_img.cols);
-  datum->set_label(label);
+  datum->set_encoded(false);
   datum->clear_data();
   datum->clear_float_data();
   string* datum_string = datum->mutable_data();
-  if (is_color) {
+  datum_string->reserve(num_channels * cv_img.rows * cv_img.cols);
+  if (num_channels == 3) {
     for (int c = 0; c < num_channels; ++c) {
       for (int h = 0; h < cv_img.rows; ++h) {
         for (int w = 0; w < cv_img.cols; ++w) {
@@ -108,6 +139,87 @@ bool ReadImageToDatum(const string& filename, const int label,
         }
       }
   }
+}
+
+bool ReadImageToDatum(const string& filename, const int label,
+    const int height, const int width, const bool is_color, Datum* datum) {
+  cv::Mat cv_img = ReadImageToCVMat(filename, height, width, is_color);
+  if (!cv_img.data) {
+    return false;
+  }
+  CVMatToDatum(cv_img, datum);
+  datum->set_label(label);
+  return true;
+}
+
+bool ReadImageToDatum(const string& filename, const int label,
+    const int height, const int width, const bool is_color,
+    const string& encoding, Datum* datum) {
+  cv::Mat cv_img = ReadImageToCVMat(filename, height, width, is_color);
+  if (!cv_img.data) {
+    return false;
+  }
+  vector<uchar> buf;
+  if (!cv::imencode("." + encoding, cv_img, buf)) {
+    LOG(ERROR) << "Could not encode " << filename << " as " << encoding;
+    return false;
+  }
+  datum->set_channels(is_color ? 3 : 1);
+  datum->clear_height();
+  datum->clear_width();
+  datum->clear_float_data();
+  datum->set_data(string(reinterpret_cast<char*>(&buf[0]), buf.size()));
+  datum->set_encoded(true);
+  datum->set_label(label);
+  return true;
+}
+
+bool ReadFileToString(const string& filename, string* contents) {
+  std::ifstream file(filename.c_str(),
+      std::ios::in | std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    LOG(ERROR) << "Could not open or find file " << filename;
+    return false;
+  }
+  const std::streampos size = file.tellg();
+  contents->resize(size);
+  file.seekg(0, std::ios::beg);
+  if (size > 0 && !file.read(&(*contents)[0], size)) {
+    LOG(ERROR) << "Could not read file " << filename;
+    return false;
+  }
+  return true;
+}
+
+bool ReadFileToDatum(const string& filename, const int label,
+    const bool is_color, Datum* datum) {
+  if (!ReadFileToString(filename, datum->mutable_data())) {
+    return false;
+  }
+  datum->set_channels(is_color ? 3 : 1);
+  datum->clear_height();
+  datum->clear_width();
+  datum->clear_float_data();
+  datum->set_encoded(true);
+  datum->set_label(label);
+  return true;
+}
+
+bool DecodeDatum(Datum* datum, const bool is_color) {
+  CHECK(datum->encoded()) << "Datum is not encoded";
+  const string& data = datum->data();
+  // imdecode reads the buffer in place.
+  cv::Mat buf(1, data.size(), CV_8UC1,
+      const_cast<char*>(data.data()));
+  // Decode to the channels asked for whatever those of the file, so that a
+  // grayscale or RGBA image in a set of color ones gets their size.
+  cv::Mat cv_img = cv::imdecode(buf,
+      is_color ? CV_LOAD_IMAGE_COLOR : CV_LOAD_IMAGE_GRAYSCALE);
+  if (!cv_img.data) {
+    LOG(ERROR) << "Could not decode datum";
+    return false;
+  }
+  CVMatToDatum(cv_img, datum);
   return true;
 }
 
@@ -119,11 +231,15 @@ leveldb::Options GetLevelDBOptions() {
   return options;
 }
 
-// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
-template <typename Dtype>
-void hdf5_load_nd_dataset_helper(
+boost::recursive_mutex& HDF5Mutex() {
+  static boost::recursive_mutex mutex;
+  return mutex;
+}
+
+void hdf5_get_nd_dataset_shape(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
-    Blob<Dtype>* blob) {
+    vector<int>* shape) {
+  boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
   // Verify that the number of dimensions is in the accepted range.
   herr_t status;
   int ndims;
@@ -140,16 +256,26 @@ void hdf5_load_nd_dataset_helper(
   CHECK_GE(status, 0) << "Failed to get dataset info for " << dataset_name_;
   CHECK_EQ(class_, H5T_FLOAT) << "Expected float or double data";
 
-  blob->Reshape(
-    dims[0],
-    (dims.size() > 1) ? dims[1] : 1,
-    (dims.size() > 2) ? dims[2] : 1,
-    (dims.size() > 3) ? dims[3] : 1);
+  shape->resize(4);
+  for (int i = 0; i < 4; ++i) {
+    (*shape)[i] = (i < dims.size()) ? dims[i] : 1;
+  }
+}
+
+// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
+template <typename Dtype>
+void hdf5_load_nd_dataset_helper(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    Blob<Dtype>* blob) {
+  vector<int> shape;
+  hdf5_get_nd_dataset_shape(file_id, dataset_name_, min_dim, max_dim, &shape);
+  blob->Reshape(shape[0], shape[1], shape[2], shape[3]);
 }
 
 template <>
 void hdf5_load_nd_dataset<float>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<float>* blob) {
+  boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob);
   herr_t status = H5LTread_dataset_float(
     file_id, dataset_name_, blob->mutable_cpu_data());
@@ -159,12 +285,60 @@ void hdf5_load_nd_dataset<float>(hid_t file_id, const char* dataset_name_,
 template <>
 void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<double>* blob) {
+  boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob);
   herr_t status = H5LTread_dataset_double(
     file_id, dataset_name_, blob->mutable_cpu_data());
   CHECK_GE(status, 0) << "Failed to read double dataset " << dataset_name_;
 }
 
+static void hdf5_load_nd_dataset_rows_helper(
+    hid_t file_id, const char* dataset_name_, hsize_t row_begin,
+    hsize_t num_rows, hid_t mem_type_id, void* data) {
+  boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
+  hid_t dataset_id = H5Dopen2(file_id, dataset_name_, H5P_DEFAULT);
+  CHECK_GE(dataset_id, 0) << "Failed to open dataset " << dataset_name_;
+  hid_t file_space_id = H5Dget_space(dataset_id);
+  CHECK_GE(file_space_id, 0) << "Failed to get dataspace of " << dataset_name_;
+  const int ndims = H5Sget_simple_extent_ndims(file_space_id);
+  CHECK_GE(ndims, 1) << "Failed to get dataset ndims for " << dataset_name_;
+  std::vector<hsize_t> dims(ndims);
+  H5Sget_simple_extent_dims(file_space_id, dims.data(), NULL);
+  CHECK_LE(row_begin + num_rows, dims[0])
+      << "Rows out of range of dataset " << dataset_name_;
+  // Select the rows in the file, and read them in a dataspace of their size.
+  std::vector<hsize_t> start(ndims, 0);
+  start[0] = row_begin;
+  dims[0] = num_rows;
+  herr_t status = H5Sselect_hyperslab(file_space_id, H5S_SELECT_SET,
+      start.data(), NULL, dims.data(), NULL);
+  CHECK_GE(status, 0) << "Failed to select rows of " << dataset_name_;
+  hid_t mem_space_id = H5Screate_simple(ndims, dims.data(), NULL);
+  CHECK_GE(mem_space_id, 0) << "Failed to create memory dataspace";
+  status = H5Dread(dataset_id, mem_type_id, mem_space_id, file_space_id,
+      H5P_DEFAULT, data);
+  CHECK_GE(status, 0) << "Failed to read rows of dataset " << dataset_name_;
+  H5Sclose(mem_space_id);
+  H5Sclose(file_space_id);
+  H5Dclose(dataset_id);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<float>(hid_t file_id,
+    const char* dataset_name_, hsize_t row_begin, hsize_t num_rows,
+    float* data) {
+  hdf5_load_nd_dataset_rows_helper(file_id, dataset_name_, row_begin,
+      num_rows, H5T_NATIVE_FLOAT, data);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<double>(hid_t file_id,
+    const char* dataset_name_, hsize_t row_begin, hsize_t num_rows,
+    double* data) {
+  hdf5_load_nd_dataset_rows_helper(file_id, dataset_name_, row_begin,
+      num_rows, H5T_NATIVE_DOUBLE, data);
+}
+
 template <>
 void hdf5_save_nd_dataset<float>(
     const hid_t file_id, const string dataset_name, const Blob<float>& blob) {
@@ -173,6 +347,7 @@ void hdf5_save_nd_dataset<float>(
   dims[1] = blob.channels();
   dims[2] = blob.height();
   dims[3] = blob.width();
+  boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
   herr_t status = H5LTmake_dataset_float(
       file_id, dataset_name.c_str(), HDF5_NUM_DIMS, dims, blob.cpu_data());
   CHECK_GE(status, 0) << "Failed to make float dataset " << dataset_name;
@@ -186,6 +361,7 @@ void hdf5_save_nd_dataset<double>(
   dims[1] = blob.channels();
   dims[2] = blob.height();
   dims[3] = blob.width();
+  boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
   herr_t status = H5LTmake_dataset_double(
       file_id, dataset_name.c_str(), HDF5_NUM_DIMS, dims, blob.cpu_data());
   CHECK_GE(status, 0) << "Failed to make double dataset " << dataset_name;
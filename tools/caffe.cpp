@@ -29,6 +29,15 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_int32(host_cache_mb, 0,
+    "The MB of freed host memory to cache for reuse.");
+DEFINE_int32(host_alignment, 64,
+    "The alignment in bytes of host memory; 0 for that of malloc.");
+DEFINE_bool(huge_pages, false,
+    "Back the host memory blocks of 2 MB or more with huge pages.");
+DEFINE_string(numa_policy, "local",
+    "The NUMA placement of host memory: 'local' to the allocating thread, "
+    "'first_touch' by the computing threads, or 'interleave' across nodes.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -217,6 +226,7 @@ int time() {
   caffe_net.Forward(vector<Blob<float>*>(), &initial_loss);
   LOG(INFO) << "Initial loss: " << initial_loss;
   LOG(INFO) << "Performing Backward";
+  caffe_net.ClearParamDiffs();
   caffe_net.Backward();
 
   const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
@@ -262,6 +272,10 @@ int time() {
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() <<
       " milliseconds.";
   LOG(INFO) << "*** Benchmark ends ***";
+  const caffe::HostAllocator& allocator = caffe::HostAllocator::Get();
+  LOG(INFO) << "Host memory: " << allocator.bytes_in_use() << " bytes in use, "
+      << allocator.peak_bytes_in_use() << " at peak, "
+      << allocator.bytes_cached() << " cached.";
   return 0;
 }
 RegisterBrewFunction(time);
@@ -279,6 +293,20 @@ int main(int argc, char** argv) {
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::HostAllocator& allocator = caffe::HostAllocator::Get();
+  allocator.set_max_cached_bytes(static_cast<size_t>(FLAGS_host_cache_mb)
+      << 20);
+  allocator.set_alignment(FLAGS_host_alignment);
+  allocator.set_huge_pages(FLAGS_huge_pages);
+  if (FLAGS_numa_policy == "local") {
+    allocator.set_numa_policy(caffe::HostAllocator::LOCAL);
+  } else if (FLAGS_numa_policy == "first_touch") {
+    allocator.set_numa_policy(caffe::HostAllocator::FIRST_TOUCH);
+  } else if (FLAGS_numa_policy == "interleave") {
+    allocator.set_numa_policy(caffe::HostAllocator::INTERLEAVE);
+  } else {
+    LOG(FATAL) << "Unknown NUMA policy: " << FLAGS_numa_policy;
+  }
   if (argc == 2) {
     return GetBrewFunction(caffe::string(argv[1]))();
   } else {
@@ -1,170 +1,222 @@
+// This program computes the mean image of a leveldb/lmdb/recordfile of
+// Datums, and logs the mean and standard deviation of each channel.
+// Usage:
+//   compute_image_mean [FLAGS] INPUT_DB OUTPUT_FILE [BACKEND]
+//
+// The records are split between --threads threads in contiguous ranges,
+// each thread seeking to the first key of its range, and the partial sums
+// are merged in double precision. With --sample, each record is only summed
+// with that probability, drawn from the random stream of its thread: the
+// records sampled change with the number of threads.
+
+#include <gflags/gflags.h>
 #include <glog/logging.h>
-#include <leveldb/db.h>
-#include <lmdb.h>
 #include <stdint.h>
 
 #include <algorithm>
+#include <cmath>
 #include <string>
+#include <vector>
+
+#include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
-using caffe::Datum;
-using caffe::BlobProto;
+using namespace caffe;  // NOLINT(build/namespaces)
+using boost::scoped_ptr;
 using std::string;
-using std::max;
+
+DEFINE_int32(threads, 0,
+    "The number of threads reading the records; 0 for one per core");
+DEFINE_double(sample, 1,
+    "The fraction of the records, drawn at random, to compute the mean of");
+
+// The sums of the records read by a thread: the sum of each element, and
+// the sum of the squares of the elements of each channel.
+struct PartialSum {
+  vector<double> sum;
+  vector<double> channel_sum_squares;
+  int count;
+};
+
+static boost::mutex progress_mutex;
+static int progress_count = 0;
+
+// Sums the num_records records from the one of key begin_key.
+static void SumRecords(db::Cursor* cursor, const string& begin_key,
+    int num_records, unsigned int seed, int channels, int data_size,
+    PartialSum* partial) {
+  partial->sum.assign(data_size, 0);
+  partial->channel_sum_squares.assign(channels, 0);
+  partial->count = 0;
+  const int channel_size = data_size / channels;
+  caffe::rng_t rng(seed);
+  Datum datum;
+  int unreported = 0;
+  if (num_records > 0) {
+    cursor->Seek(begin_key);
+  }
+  for (int record = 0; record < num_records; ++record, cursor->Next()) {
+    CHECK(cursor->valid()) << "Record missing from the database";
+    if (FLAGS_sample < 1 &&
+        static_cast<double>(rng() - rng.min()) / (rng.max() - rng.min()) >=
+        FLAGS_sample) {
+      continue;
+    }
+    datum.ParseFromString(cursor->value());
+    if (datum.encoded()) {
+      CHECK(DecodeDatum(&datum, channels != 1)) << "Could not decode datum";
+    }
+    const string& data = datum.data();
+    const int size_in_datum = std::max<int>(datum.data().size(),
+        datum.float_data_size());
+    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
+        size_in_datum;
+    for (int c = 0; c < channels; ++c) {
+      double sum_squares = 0;
+      for (int i = c * channel_size; i < (c + 1) * channel_size; ++i) {
+        const double value = data.size() != 0 ?
+            static_cast<double>(static_cast<uint8_t>(data[i])) :
+            static_cast<double>(datum.float_data(i));
+        partial->sum[i] += value;
+        sum_squares += value * value;
+      }
+      partial->channel_sum_squares[c] += sum_squares;
+    }
+    ++partial->count;
+    if (++unreported == 1000) {
+      boost::mutex::scoped_lock lock(progress_mutex);
+      const int previous_count = progress_count;
+      progress_count += unreported;
+      if (progress_count / 10000 != previous_count / 10000) {
+        LOG(ERROR) << "Processed " << progress_count << " files.";
+      }
+      unreported = 0;
+    }
+  }
+}
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Compute the mean image of a set of Datums.\n"
+        "Usage:\n"
+        "    compute_image_mean [FLAGS] INPUT_DB OUTPUT_FILE "
+        "[BACKEND: leveldb, lmdb or recordfile]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
   if (argc < 3 || argc > 4) {
-    LOG(ERROR) << "Usage: compute_image_mean input_db output_file"
-               << " db_backend[leveldb or lmdb]";
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/compute_image_mean");
     return 1;
   }
+  CHECK(FLAGS_sample > 0 && FLAGS_sample <= 1)
+      << "sample must be in (0, 1]";
 
   string db_backend = "lmdb";
   if (argc == 4) {
     db_backend = string(argv[3]);
   }
 
-  // leveldb
-  leveldb::DB* db;
-  leveldb::Options options;
-  options.create_if_missing = false;
-  leveldb::Iterator* it = NULL;
-  // lmdb
-  MDB_env* mdb_env;
-  MDB_dbi mdb_dbi;
-  MDB_val mdb_key, mdb_value;
-  MDB_txn* mdb_txn;
-  MDB_cursor* mdb_cursor;
-
-  // Open db
-  if (db_backend == "leveldb") {  // leveldb
-    LOG(INFO) << "Opening leveldb " << argv[1];
-    leveldb::Status status = leveldb::DB::Open(
-        options, argv[1], &db);
-    CHECK(status.ok()) << "Failed to open leveldb " << argv[1];
-    leveldb::ReadOptions read_options;
-    read_options.fill_cache = false;
-    it = db->NewIterator(read_options);
-    it->SeekToFirst();
-  } else if (db_backend == "lmdb") {  // lmdb
-    LOG(INFO) << "Opening lmdb " << argv[1];
-    CHECK_EQ(mdb_env_create(&mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(mdb_env, 1099511627776), MDB_SUCCESS);  // 1TB
-    CHECK_EQ(mdb_env_open(mdb_env, argv[1], MDB_RDONLY, 0664),
-        MDB_SUCCESS) << "mdb_env_open failed";
-    CHECK_EQ(mdb_txn_begin(mdb_env, NULL, MDB_RDONLY, &mdb_txn), MDB_SUCCESS)
-        << "mdb_txn_begin failed";
-    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &mdb_dbi), MDB_SUCCESS)
-        << "mdb_open failed";
-    CHECK_EQ(mdb_cursor_open(mdb_txn, mdb_dbi, &mdb_cursor), MDB_SUCCESS)
-        << "mdb_cursor_open failed";
-    CHECK_EQ(mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_FIRST),
-        MDB_SUCCESS);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
-  }
+  scoped_ptr<db::DB> db(db::GetDB(db_backend));
+  db->Open(argv[1], db::READ);
 
-  Datum datum;
-  BlobProto sum_blob;
-  int count = 0;
   // load first datum
-  if (db_backend == "leveldb") {
-    datum.ParseFromString(it->value().ToString());
-  } else if (db_backend == "lmdb") {
-    datum.ParseFromArray(mdb_value.mv_data, mdb_value.mv_size);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
+  Datum datum;
+  {
+    scoped_ptr<db::Cursor> cursor(db->NewCursor());
+    CHECK(cursor->valid()) << "Empty database " << argv[1];
+    datum.ParseFromString(cursor->value());
   }
-
-  sum_blob.set_num(1);
-  sum_blob.set_channels(datum.channels());
-  sum_blob.set_height(datum.height());
-  sum_blob.set_width(datum.width());
+  if (datum.encoded()) {
+    CHECK(DecodeDatum(&datum)) << "Could not decode datum";
+  }
+  const int channels = datum.channels();
   const int data_size = datum.channels() * datum.height() * datum.width();
-  int size_in_datum = std::max<int>(datum.data().size(),
-                                    datum.float_data_size());
-  for (int i = 0; i < size_in_datum; ++i) {
-    sum_blob.add_data(0.);
+
+  const int num_threads = FLAGS_threads > 0 ? FLAGS_threads :
+      std::max<int>(1, boost::thread::hardware_concurrency());
+  // Gather the keys in one walk, then split the records between the threads
+  // in contiguous ranges, records [i * n / num_threads,
+  // (i + 1) * n / num_threads). On LevelDB the walk reads the values as
+  // well, so the database is read twice in all.
+  vector<string> keys;
+  {
+    scoped_ptr<db::Cursor> cursor(db->NewCursor());
+    for (cursor->SeekToFirst(); cursor->valid(); cursor->Next()) {
+      keys.push_back(cursor->key());
+    }
   }
-  LOG(INFO) << "Starting Iteration";
-  if (db_backend == "leveldb") {  // leveldb
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-      // just a dummy operation
-      datum.ParseFromString(it->value().ToString());
-      const string& data = datum.data();
-      size_in_datum = std::max<int>(datum.data().size(),
-          datum.float_data_size());
-      CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-          size_in_datum;
-      if (data.size() != 0) {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
-        }
-      } else {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) +
-              static_cast<float>(datum.float_data(i)));
-        }
-      }
-      ++count;
-      if (count % 10000 == 0) {
-        LOG(ERROR) << "Processed " << count << " files.";
-      }
+  const int num_records = keys.size();
+  vector<int> range_begins(num_threads + 1);
+  vector<string> begin_keys(num_threads);
+  for (int i = 0; i <= num_threads; ++i) {
+    range_begins[i] = static_cast<int64_t>(i) * num_records / num_threads;
+    if (i < num_threads && range_begins[i] < num_records) {
+      begin_keys[i] = keys[range_begins[i]];
     }
-  } else if (db_backend == "lmdb") {  // lmdb
-    CHECK_EQ(mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_FIRST),
-        MDB_SUCCESS);
-    do {
-      // just a dummy operation
-      datum.ParseFromArray(mdb_value.mv_data, mdb_value.mv_size);
-      const string& data = datum.data();
-      size_in_datum = std::max<int>(datum.data().size(),
-          datum.float_data_size());
-      CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-          size_in_datum;
-      if (data.size() != 0) {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
-        }
-      } else {
-        for (int i = 0; i < size_in_datum; ++i) {
-          sum_blob.set_data(i, sum_blob.data(i) +
-              static_cast<float>(datum.float_data(i)));
-        }
-      }
-      ++count;
-      if (count % 10000 == 0) {
-        LOG(ERROR) << "Processed " << count << " files.";
-      }
-    } while (mdb_cursor_get(mdb_cursor, &mdb_key, &mdb_value, MDB_NEXT)
-        == MDB_SUCCESS);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
   }
+  LOG(INFO) << "Starting Iteration with " << num_threads << " threads";
+  vector<shared_ptr<db::Cursor> > cursors;
+  vector<PartialSum> partials(num_threads);
+  boost::thread_group threads;
+  for (int i = 0; i < num_threads; ++i) {
+    cursors.push_back(shared_ptr<db::Cursor>(db->NewCursor()));
+    threads.create_thread(boost::bind(&SumRecords, cursors[i].get(),
+        begin_keys[i], range_begins[i + 1] - range_begins[i],
+        caffe_rng_rand(), channels, data_size, &partials[i]));
+  }
+  threads.join_all();
 
-  if (count % 10000 != 0) {
-    LOG(ERROR) << "Processed " << count << " files.";
+  // Merge the partial sums.
+  vector<double> sum(data_size, 0);
+  vector<double> channel_sum_squares(channels, 0);
+  int count = 0;
+  for (int i = 0; i < num_threads; ++i) {
+    for (int j = 0; j < data_size; ++j) {
+      sum[j] += partials[i].sum[j];
+    }
+    for (int c = 0; c < channels; ++c) {
+      channel_sum_squares[c] += partials[i].channel_sum_squares[c];
+    }
+    count += partials[i].count;
   }
-  for (int i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
+  LOG(ERROR) << "Processed " << count << " files.";
+  CHECK_GT(count, 0) << "No record sampled";
+
+  BlobProto sum_blob;
+  sum_blob.set_num(1);
+  sum_blob.set_channels(datum.channels());
+  sum_blob.set_height(datum.height());
+  sum_blob.set_width(datum.width());
+  for (int i = 0; i < data_size; ++i) {
+    sum_blob.add_data(sum[i] / count);
   }
   // Write to disk
   LOG(INFO) << "Write to " << argv[2];
   WriteProtoToBinaryFile(sum_blob, argv[2]);
 
-  // Clean up
-  if (db_backend == "leveldb") {
-    delete db;
-  } else if (db_backend == "lmdb") {
-    mdb_cursor_close(mdb_cursor);
-    mdb_close(mdb_env, mdb_dbi);
-    mdb_txn_abort(mdb_txn);
-    mdb_env_close(mdb_env);
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
+  // The statistics of each channel, over all its pixels.
+  const int channel_size = data_size / channels;
+  for (int c = 0; c < channels; ++c) {
+    double channel_sum = 0;
+    for (int i = c * channel_size; i < (c + 1) * channel_size; ++i) {
+      channel_sum += sum[i];
+    }
+    const double num_values = static_cast<double>(count) * channel_size;
+    const double mean = channel_sum / num_values;
+    const double variance =
+        std::max(0., channel_sum_squares[c] / num_values - mean * mean);
+    LOG(INFO) << "Channel " << c << ": mean " << mean << ", std "
+        << std::sqrt(variance);
   }
   return 0;
 }
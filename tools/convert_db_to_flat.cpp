@@ -0,0 +1,88 @@
+// This program converts a leveldb/lmdb/recordfile of Datums to a
+// FlatDataset file, which DataLayer reads in place with backend: FLAT.
+// Encoded datums are decoded.
+// Usage:
+//   convert_db_to_flat [FLAGS] INPUT_DB OUTPUT_FILE
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <string>
+
+#include "boost/scoped_ptr.hpp"
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/flat_dataset.hpp"
+#include "caffe/util/io.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using boost::scoped_ptr;
+using std::string;
+
+DEFINE_string(backend, "lmdb",
+    "The backend {lmdb, leveldb, recordfile} of the input database");
+DEFINE_string(data_type, "auto",
+    "The type {auto, uint8, float} of the stored records; auto keeps uint8 "
+    "when the datums hold bytes");
+DEFINE_bool(index, false, "Write an index of the record offsets");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Convert a leveldb/lmdb/recordfile of Datums to\n"
+        "a flat dataset of decoded records.\n"
+        "Usage:\n"
+        "    convert_db_to_flat [FLAGS] INPUT_DB OUTPUT_FILE\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_db_to_flat");
+    return 1;
+  }
+
+  scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
+  db->Open(argv[1], db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  CHECK(cursor->valid()) << "Empty database " << argv[1];
+
+  Datum datum;
+  datum.ParseFromString(cursor->value());
+  if (datum.encoded()) {
+    CHECK(DecodeDatum(&datum)) << "Could not decode datum";
+  }
+  // The records are decoded to the channels of the first one.
+  const bool is_color = datum.channels() != 1;
+  FlatDataset::DataType data_type;
+  if (FLAGS_data_type == "uint8") {
+    data_type = FlatDataset::UINT8;
+  } else if (FLAGS_data_type == "float") {
+    data_type = FlatDataset::FLOAT;
+  } else {
+    CHECK_EQ(FLAGS_data_type, "auto") << "Unknown data type";
+    data_type = datum.data().size() ? FlatDataset::UINT8 : FlatDataset::FLOAT;
+  }
+
+  FlatDatasetWriter writer;
+  writer.Open(argv[2], data_type, FLAGS_index);
+  int count = 0;
+  for (; cursor->valid(); cursor->Next()) {
+    datum.ParseFromString(cursor->value());
+    if (datum.encoded()) {
+      CHECK(DecodeDatum(&datum, is_color)) << "Could not decode datum";
+    }
+    writer.Write(datum);
+    if (++count % 10000 == 0) {
+      LOG(ERROR) << "Processed " << count << " records.";
+    }
+  }
+  if (count % 10000 != 0) {
+    LOG(ERROR) << "Processed " << count << " records.";
+  }
+  writer.Close();
+  return 0;
+}
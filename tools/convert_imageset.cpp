@@ -1,4 +1,5 @@
-// This program converts a set of images to a lmdb/leveldb by storing them
+// This program converts a set of images to a lmdb/leveldb/recordfile by
+// storing them
 // as Datum proto buffers.
 // Usage:
 //   convert_imageset [FLAGS] ROOTFOLDER/ LISTFILE DB_NAME
@@ -7,13 +8,15 @@
 // should be a list of files as well as their labels, in the format as
 //   subfolder1/file1.JPEG 7
 //   ....
+//
+// The images are read and resized by --threads threads and written in the
+// order of the list. After every --checkpoint_every images the progress is
+// saved to DB_NAME.progress, from which --resume continues an interrupted
+// conversion of a leveldb or lmdb.
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
-#include <leveldb/db.h>
-#include <leveldb/write_batch.h>
-#include <lmdb.h>
-#include <sys/stat.h>
+#include <stdio.h>
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
@@ -21,21 +24,180 @@
 #include <utility>
 #include <vector>
 
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
+
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 using std::pair;
+using boost::scoped_ptr;
 using std::string;
 
 DEFINE_bool(gray, false,
     "When this option is on, treat images as grayscale ones");
 DEFINE_bool(shuffle, false,
     "Randomly shuffle the order of images and their labels");
-DEFINE_string(backend, "lmdb", "The backend for storing the result");
+DEFINE_string(backend, "lmdb",
+    "The backend {lmdb, leveldb, recordfile} for storing the result");
 DEFINE_int32(resize_width, 0, "Width images are resized to");
 DEFINE_int32(resize_height, 0, "Height images are resized to");
+DEFINE_bool(encoded, false,
+    "When this option is on, store the encoded images instead of their "
+    "pixels; the data layers decode them");
+DEFINE_string(encode_type, "",
+    "Optional format (such as jpg or png) to re-encode the images in; by "
+    "default the image files are stored as they are unless gray or a "
+    "resize is requested, in which case png is used");
+DEFINE_int32(threads, 0,
+    "The number of threads reading and resizing the images; 0 for one per "
+    "core");
+DEFINE_int32(checkpoint_every, 1000,
+    "The number of images written per transaction, after each of which the "
+    "progress is saved");
+DEFINE_bool(resume, false,
+    "Continue an interrupted conversion into DB_NAME from its last saved "
+    "progress, with the same LISTFILE and flags");
+
+// The progress of a conversion: the next line of the list to convert, the
+// number of images written, and the seed the list was shuffled with.
+struct Progress {
+  int next_line;
+  int count;
+  unsigned int seed;
+};
+
+static bool ReadProgress(const string& filename, Progress* progress) {
+  std::ifstream file(filename.c_str());
+  return static_cast<bool>(file >> progress->next_line >> progress->count
+      >> progress->seed);
+}
+
+// Replaces the progress file at once, so that a crash leaves either the old
+// or the new progress.
+static void WriteProgress(const string& filename, const Progress& progress) {
+  const string temp_filename = filename + ".tmp";
+  {
+    std::ofstream file(temp_filename.c_str());
+    file << progress.next_line << " " << progress.count << " "
+        << progress.seed << std::endl;
+    CHECK(file.good()) << "Failed to write " << temp_filename;
+  }
+  CHECK_EQ(rename(temp_filename.c_str(), filename.c_str()), 0)
+      << "Failed to write " << filename;
+}
+
+static float SecondsSince(const boost::posix_time::ptime& start_time) {
+  return (boost::posix_time::microsec_clock::local_time() - start_time)
+      .total_milliseconds() / 1000.;
+}
+
+// Reads and resizes the images of the list on worker threads, and hands
+// them out in the order of the list. The workers stay at most window images
+// ahead of the images taken.
+class ImageConverter {
+ public:
+  ImageConverter(const vector<pair<string, int> >& lines,
+      const string& root_folder, const string& encode_type, int first_line,
+      int num_threads)
+      : lines_(lines), root_folder_(root_folder), encode_type_(encode_type),
+        next_line_(first_line), taken_line_(first_line),
+        slots_(8 * num_threads) {
+    for (int i = 0; i < num_threads; ++i) {
+      threads_.create_thread(boost::bind(&ImageConverter::Work, this));
+    }
+  }
+  ~ImageConverter() { threads_.join_all(); }
+
+  // Blocks until line line_id, the one after the previous line taken, is
+  // converted. Returns false if its image could not be read, else moves the
+  // serialized datum into value and its data size into data_size.
+  bool Take(int line_id, string* value, int* data_size) {
+    boost::mutex::scoped_lock lock(mutex_);
+    CHECK_EQ(line_id, taken_line_);
+    Slot& slot = slots_[line_id % slots_.size()];
+    while (!slot.done) {
+      converted_.wait(lock);
+    }
+    const bool ok = slot.ok;
+    value->swap(slot.value);
+    *data_size = slot.data_size;
+    slot.done = false;
+    // The slot is free for the line window lines ahead.
+    ++taken_line_;
+    lock.unlock();
+    taken_.notify_all();
+    return ok;
+  }
+
+ protected:
+  struct Slot {
+    Slot() : done(false), ok(false), data_size(0) {}
+    bool done;
+    bool ok;
+    int data_size;
+    string value;
+  };
+
+  void Work() {
+    Datum datum;
+    string value;
+    while (true) {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (next_line_ < lines_.size() &&
+             next_line_ >= taken_line_ + slots_.size()) {
+        taken_.wait(lock);
+      }
+      if (next_line_ >= lines_.size()) {
+        return;
+      }
+      const int line_id = next_line_++;
+      lock.unlock();
+
+      const bool ok = Convert(lines_[line_id], &datum);
+      if (ok) {
+        datum.SerializeToString(&value);
+      }
+
+      lock.lock();
+      Slot& slot = slots_[line_id % slots_.size()];
+      slot.ok = ok;
+      slot.data_size = datum.data().size();
+      slot.value.swap(value);
+      slot.done = true;
+      lock.unlock();
+      converted_.notify_all();
+    }
+  }
+
+  bool Convert(const pair<string, int>& line, Datum* datum) {
+    const string path = root_folder_ + line.first;
+    if (!FLAGS_encoded) {
+      return ReadImageToDatum(path, line.second, FLAGS_resize_height,
+          FLAGS_resize_width, !FLAGS_gray, datum);
+    } else if (encode_type_.empty()) {
+      return ReadFileToDatum(path, line.second, !FLAGS_gray, datum);
+    }
+    return ReadImageToDatum(path, line.second, FLAGS_resize_height,
+        FLAGS_resize_width, !FLAGS_gray, encode_type_, datum);
+  }
+
+  const vector<pair<string, int> >& lines_;
+  const string root_folder_;
+  const string encode_type_;
+  boost::mutex mutex_;
+  boost::condition_variable converted_;
+  boost::condition_variable taken_;
+  int next_line_;
+  int taken_line_;
+  vector<Slot> slots_;
+  boost::thread_group threads_;
+};
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -44,8 +206,8 @@ int main(int argc, char** argv) {
   namespace gflags = google;
 #endif
 
-  gflags::SetUsageMessage("Convert a set of images to the leveldb/lmdb\n"
-        "format used as input for Caffe.\n"
+  gflags::SetUsageMessage("Convert a set of images to the\n"
+        "leveldb/lmdb/recordfile format used as input for Caffe.\n"
         "Usage:\n"
         "    convert_imageset [FLAGS] ROOTFOLDER/ LISTFILE DB_NAME\n"
         "The ImageNet dataset for the training demo is at\n"
@@ -57,7 +219,22 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  bool is_color = !FLAGS_gray;
+  const string db_name(argv[3]);
+  const string progress_filename = db_name + ".progress";
+  Progress progress;
+  progress.next_line = 0;
+  progress.count = 0;
+  progress.seed = caffe_rng_rand();
+  if (FLAGS_resume) {
+    CHECK_NE(FLAGS_backend, "recordfile")
+        << "A record file is not readable before it is closed, so its "
+        << "conversion cannot be resumed";
+    CHECK(ReadProgress(progress_filename, &progress))
+        << "No progress to resume from in " << progress_filename;
+    LOG(INFO) << "Resuming from line " << progress.next_line << " with "
+        << progress.count << " images written";
+  }
+
   std::ifstream infile(argv[2]);
   std::vector<std::pair<string, int> > lines;
   string filename;
@@ -66,131 +243,99 @@ int main(int argc, char** argv) {
     lines.push_back(std::make_pair(filename, label));
   }
   if (FLAGS_shuffle) {
-    // randomly shuffle data
+    // randomly shuffle data, in the same order when resuming
     LOG(INFO) << "Shuffling data";
+    Caffe::set_random_seed(progress.seed);
     shuffle(lines.begin(), lines.end());
   }
   LOG(INFO) << "A total of " << lines.size() << " images.";
+  CHECK_LE(progress.next_line, lines.size())
+      << "The list is shorter than the progress to resume from";
 
-  const string& db_backend = FLAGS_backend;
-  const char* db_path = argv[3];
-
-  int resize_height = std::max<int>(0, FLAGS_resize_height);
-  int resize_width = std::max<int>(0, FLAGS_resize_width);
-
-  // Open new db
-  // lmdb
-  MDB_env *mdb_env;
-  MDB_dbi mdb_dbi;
-  MDB_val mdb_key, mdb_data;
-  MDB_txn *mdb_txn;
-  // leveldb
-  leveldb::DB* db;
-  leveldb::Options options;
-  options.error_if_exists = true;
-  options.create_if_missing = true;
-  options.write_buffer_size = 268435456;
-  leveldb::WriteBatch* batch = NULL;
-
-  // Open db
-  if (db_backend == "leveldb") {  // leveldb
-    LOG(INFO) << "Opening leveldb " << db_path;
-    leveldb::Status status = leveldb::DB::Open(
-        options, db_path, &db);
-    CHECK(status.ok()) << "Failed to open leveldb " << db_path
-        << ". Is it already existing?";
-    batch = new leveldb::WriteBatch();
-  } else if (db_backend == "lmdb") {  // lmdb
-    LOG(INFO) << "Opening lmdb " << db_path;
-    CHECK_EQ(mkdir(db_path, 0744), 0)
-        << "mkdir " << db_path << "failed";
-    CHECK_EQ(mdb_env_create(&mdb_env), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(mdb_env, 1099511627776), MDB_SUCCESS)  // 1TB
-        << "mdb_env_set_mapsize failed";
-    CHECK_EQ(mdb_env_open(mdb_env, db_path, 0, 0664), MDB_SUCCESS)
-        << "mdb_env_open failed";
-    CHECK_EQ(mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn), MDB_SUCCESS)
-        << "mdb_txn_begin failed";
-    CHECK_EQ(mdb_open(mdb_txn, NULL, 0, &mdb_dbi), MDB_SUCCESS)
-        << "mdb_open failed. Does the lmdb already exist? ";
-  } else {
-    LOG(FATAL) << "Unknown db backend " << db_backend;
+  const bool transform = FLAGS_gray ||
+      (FLAGS_resize_height > 0 && FLAGS_resize_width > 0);
+  string encode_type = FLAGS_encode_type;
+  if (FLAGS_encoded && transform && encode_type.empty()) {
+    encode_type = "png";
+  }
+  const int num_threads = FLAGS_threads > 0 ? FLAGS_threads :
+      std::max<int>(1, boost::thread::hardware_concurrency());
+  CHECK_GT(FLAGS_checkpoint_every, 0);
+  LOG(INFO) << "Converting with " << num_threads << " threads";
+
+  // Create new DB, or reopen it to resume
+  scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
+  db->Open(db_name, FLAGS_resume ? db::WRITE : db::NEW);
+  scoped_ptr<db::Transaction> txn(db->NewTransaction());
+  if (!FLAGS_resume) {
+    // Save the seed of the shuffle before anything is written.
+    WriteProgress(progress_filename, progress);
   }
 
   // Storing to db
   string root_folder(argv[1]);
-  Datum datum;
-  int count = 0;
+  ImageConverter converter(lines, root_folder, encode_type,
+      progress.next_line, num_threads);
   const int kMaxKeyLength = 256;
   char key_cstr[kMaxKeyLength];
-  int data_size;
+  int data_size = 0;
   bool data_size_initialized = false;
+  int num_failed = 0;
+  size_t bytes_written = 0;
+  const boost::posix_time::ptime start_time =
+      boost::posix_time::microsec_clock::local_time();
 
-  for (int line_id = 0; line_id < lines.size(); ++line_id) {
-    if (!ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color, &datum)) {
+  string value;
+  int image_data_size;
+  const int first_line = progress.next_line;
+  for (int line_id = first_line; line_id < lines.size(); ++line_id) {
+    if (!converter.Take(line_id, &value, &image_data_size)) {
+      ++num_failed;
       continue;
     }
-    if (!data_size_initialized) {
-      data_size = datum.channels() * datum.height() * datum.width();
-      data_size_initialized = true;
-    } else {
-      const string& data = datum.data();
-      CHECK_EQ(data.size(), data_size) << "Incorrect data field size "
-          << data.size();
+    // encoded images may differ in size
+    if (!FLAGS_encoded) {
+      if (!data_size_initialized) {
+        data_size = image_data_size;
+        data_size_initialized = true;
+      } else {
+        CHECK_EQ(image_data_size, data_size) << "Incorrect data field size "
+            << image_data_size;
+      }
     }
     // sequential
     snprintf(key_cstr, kMaxKeyLength, "%08d_%s", line_id,
         lines[line_id].first.c_str());
-    string value;
-    datum.SerializeToString(&value);
-    string keystr(key_cstr);
 
     // Put in db
-    if (db_backend == "leveldb") {  // leveldb
-      batch->Put(keystr, value);
-    } else if (db_backend == "lmdb") {  // lmdb
-      mdb_data.mv_size = value.size();
-      mdb_data.mv_data = reinterpret_cast<void*>(&value[0]);
-      mdb_key.mv_size = keystr.size();
-      mdb_key.mv_data = reinterpret_cast<void*>(&keystr[0]);
-      CHECK_EQ(mdb_put(mdb_txn, mdb_dbi, &mdb_key, &mdb_data, 0), MDB_SUCCESS)
-          << "mdb_put failed";
-    } else {
-      LOG(FATAL) << "Unknown db backend " << db_backend;
-    }
+    txn->Put(string(key_cstr), value);
+    bytes_written += value.size();
 
-    if (++count % 1000 == 0) {
-      // Commit txn
-      if (db_backend == "leveldb") {  // leveldb
-        db->Write(leveldb::WriteOptions(), batch);
-        delete batch;
-        batch = new leveldb::WriteBatch();
-      } else if (db_backend == "lmdb") {  // lmdb
-        CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS)
-            << "mdb_txn_commit failed";
-        CHECK_EQ(mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn), MDB_SUCCESS)
-            << "mdb_txn_begin failed";
-      } else {
-        LOG(FATAL) << "Unknown db backend " << db_backend;
-      }
-      LOG(ERROR) << "Processed " << count << " files.";
+    if (++progress.count % FLAGS_checkpoint_every == 0) {
+      // Commit db, then save the progress it holds
+      txn->Commit();
+      txn.reset(db->NewTransaction());
+      progress.next_line = line_id + 1;
+      WriteProgress(progress_filename, progress);
+      LOG(ERROR) << "Processed " << progress.count << " files, "
+          << (line_id + 1 - first_line) / SecondsSince(start_time)
+          << " files/s.";
     }
   }
   // write the last batch
-  if (count % 1000 != 0) {
-    if (db_backend == "leveldb") {  // leveldb
-      db->Write(leveldb::WriteOptions(), batch);
-      delete batch;
-      delete db;
-    } else if (db_backend == "lmdb") {  // lmdb
-      CHECK_EQ(mdb_txn_commit(mdb_txn), MDB_SUCCESS) << "mdb_txn_commit failed";
-      mdb_close(mdb_env, mdb_dbi);
-      mdb_env_close(mdb_env);
-    } else {
-      LOG(FATAL) << "Unknown db backend " << db_backend;
-    }
-    LOG(ERROR) << "Processed " << count << " files.";
+  if (progress.count % FLAGS_checkpoint_every != 0) {
+    txn->Commit();
+    LOG(ERROR) << "Processed " << progress.count << " files.";
   }
+  db->Close();
+  // The conversion is complete and cannot be resumed any more.
+  remove(progress_filename.c_str());
+
+  const float seconds = SecondsSince(start_time);
+  const int num_read = lines.size() - first_line;
+  LOG(INFO) << "Converted " << num_read - num_failed << " images ("
+      << num_failed << " failed) in " << seconds << " s: "
+      << num_read / seconds << " images/s, "
+      << bytes_written / seconds / (1 << 20) << " MB/s written";
   return 0;
 }
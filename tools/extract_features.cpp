@@ -1,21 +1,280 @@
+#include <gflags/gflags.h>
 #include <stdio.h>  // for snprintf
+#include <string.h>  // for strspn
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/thread/recursive_mutex.hpp"
 #include "google/protobuf/text_format.h"
-#include "leveldb/db.h"
-#include "leveldb/write_batch.h"
+#include "hdf5.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/db.hpp"
+#include "caffe/util/flat_dataset.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/vision_layers.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 
+DEFINE_int32(num_images, 0,
+    "The number of images to extract the features of, the last batch being "
+    "truncated if needed. When set, num_mini_batches must not be given.");
+
+// Writes the features of one blob, one image at a time, to a dataset.
+// Write and Flush are called on the thread of the AsyncFeatureWriter, Flush
+// once after the last Write, and Close on the main thread afterwards.
+class FeatureWriter {
+ public:
+  virtual ~FeatureWriter() {}
+  virtual void Write(const float* feature, int dim) = 0;
+  virtual void Flush() {}
+  virtual void Close() = 0;
+};
+
+// Writes each feature as the float_data of a Datum keyed by its index, to
+// a leveldb, lmdb or recordfile. An LMDB write transaction must end on the
+// thread that began it, so the transactions are only begun and committed in
+// Write and Flush.
+class DBFeatureWriter : public FeatureWriter {
+ public:
+  DBFeatureWriter(const string& backend, const string& name)
+      : db_(db::GetDB(backend)), count_(0) {
+    db_->Open(name, db::NEW);
+  }
+  virtual void Write(const float* feature, int dim) {
+    if (!txn_) {
+      txn_.reset(db_->NewTransaction());
+    }
+    datum_.set_height(dim);
+    datum_.set_width(1);
+    datum_.set_channels(1);
+    datum_.clear_data();
+    datum_.clear_float_data();
+    for (int d = 0; d < dim; ++d) {
+      datum_.add_float_data(feature[d]);
+    }
+    string value;
+    datum_.SerializeToString(&value);
+    const int kMaxKeyStrLength = 100;
+    char key_str[kMaxKeyStrLength];
+    snprintf(key_str, kMaxKeyStrLength, "%d", count_);
+    txn_->Put(string(key_str), value);
+    if (++count_ % 1000 == 0) {
+      Flush();
+    }
+  }
+  virtual void Flush() {
+    if (txn_) {
+      txn_->Commit();
+      txn_.reset();
+    }
+  }
+  virtual void Close() {
+    CHECK(!txn_) << "Close called before Flush";
+    db_->Close();
+  }
+
+ protected:
+  shared_ptr<db::DB> db_;
+  shared_ptr<db::Transaction> txn_;
+  Datum datum_;
+  int count_;
+};
+
+// Writes the features as the float records of a FlatDataset, one
+// contiguous float32 array after a fixed size header, that can be mapped
+// in memory as is.
+class FlatFeatureWriter : public FeatureWriter {
+ public:
+  explicit FlatFeatureWriter(const string& name) {
+    writer_.Open(name, FlatDataset::FLOAT, false);
+    datum_.set_width(1);
+    datum_.set_channels(1);
+  }
+  virtual void Write(const float* feature, int dim) {
+    datum_.set_height(dim);
+    datum_.mutable_float_data()->Clear();
+    datum_.mutable_float_data()->Reserve(dim);
+    for (int d = 0; d < dim; ++d) {
+      datum_.add_float_data(feature[d]);
+    }
+    writer_.Write(datum_);
+  }
+  virtual void Close() {
+    writer_.Close();
+  }
+
+ protected:
+  FlatDatasetWriter writer_;
+  Datum datum_;
+};
+
+// Writes the features as the rows of a num x dim float dataset named
+// "data" in a new HDF5 file, extended by chunks of kChunkSize rows.
+class HDF5FeatureWriter : public FeatureWriter {
+ public:
+  explicit HDF5FeatureWriter(const string& name)
+      : name_(name), dataset_id_(-1), num_(0), dim_(0) {
+    boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
+    file_id_ = H5Fcreate(name.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
+        H5P_DEFAULT);
+    CHECK_GE(file_id_, 0) << "Failed to create HDF5 file " << name;
+  }
+  virtual void Write(const float* feature, int dim) {
+    if (dim_ == 0) {
+      dim_ = dim;
+    }
+    CHECK_EQ(dim, dim_) << "Features must have the same dimension";
+    buffer_.insert(buffer_.end(), feature, feature + dim);
+    if (buffer_.size() == kChunkSize * dim_) {
+      Flush();
+    }
+  }
+  virtual void Flush() {
+    if (buffer_.empty()) {
+      return;
+    }
+    const hsize_t rows = buffer_.size() / dim_;
+    boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
+    if (dataset_id_ < 0) {
+      hsize_t dims[2] = {0, dim_};
+      hsize_t max_dims[2] = {H5S_UNLIMITED, dim_};
+      hsize_t chunk_dims[2] = {kChunkSize, dim_};
+      hid_t space_id = H5Screate_simple(2, dims, max_dims);
+      hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
+      H5Pset_chunk(plist_id, 2, chunk_dims);
+      dataset_id_ = H5Dcreate2(file_id_, "data", H5T_NATIVE_FLOAT, space_id,
+          H5P_DEFAULT, plist_id, H5P_DEFAULT);
+      H5Pclose(plist_id);
+      H5Sclose(space_id);
+      CHECK_GE(dataset_id_, 0) << "Failed to create dataset in " << name_;
+    }
+    hsize_t dims[2] = {num_ + rows, dim_};
+    CHECK_GE(H5Dset_extent(dataset_id_, dims), 0);
+    hid_t file_space_id = H5Dget_space(dataset_id_);
+    hsize_t offset[2] = {num_, 0};
+    hsize_t count[2] = {rows, dim_};
+    H5Sselect_hyperslab(file_space_id, H5S_SELECT_SET, offset, NULL, count,
+        NULL);
+    hid_t mem_space_id = H5Screate_simple(2, count, NULL);
+    herr_t status = H5Dwrite(dataset_id_, H5T_NATIVE_FLOAT, mem_space_id,
+        file_space_id, H5P_DEFAULT, &buffer_[0]);
+    CHECK_GE(status, 0) << "Failed to write " << name_;
+    H5Sclose(mem_space_id);
+    H5Sclose(file_space_id);
+    num_ += rows;
+    buffer_.clear();
+  }
+  virtual void Close() {
+    if (file_id_ < 0) {
+      return;
+    }
+    boost::recursive_mutex::scoped_lock lock(HDF5Mutex());
+    Flush();
+    if (dataset_id_ >= 0) {
+      H5Dclose(dataset_id_);
+    }
+    CHECK_GE(H5Fclose(file_id_), 0) << "Failed to write " << name_;
+    file_id_ = -1;
+  }
+
+ protected:
+  static const int kChunkSize = 1024;
+
+  string name_;
+  hid_t file_id_;
+  hid_t dataset_id_;
+  hsize_t num_;
+  hsize_t dim_;
+  vector<float> buffer_;
+};
+
+FeatureWriter* GetFeatureWriter(const string& backend, const string& name) {
+  if (backend == "flat") {
+    return new FlatFeatureWriter(name);
+  } else if (backend == "hdf5") {
+    return new HDF5FeatureWriter(name);
+  }
+  return new DBFeatureWriter(backend, name);
+}
+
+// Writes the features copied out of the net on its own thread, so that the
+// next forward pass runs meanwhile. The features of a batch are copied into
+// one of a few slots, and the slot ids go through the full_ and free_
+// queues; -1 tells the thread to flush the writers and exit.
+class AsyncFeatureWriter : public InternalThread {
+ public:
+  AsyncFeatureWriter(const vector<shared_ptr<FeatureWriter> >& writers,
+      const vector<string>& blob_names, int num_slots)
+      : writers_(writers), blob_names_(blob_names), slots_(num_slots),
+        count_(0) {
+    for (int i = 0; i < num_slots; ++i) {
+      slots_[i].features.resize(writers.size());
+      free_.push(i);
+    }
+  }
+
+  // Copies the features of the first num images of the blobs to be written.
+  template<typename Dtype>
+  void Write(const vector<shared_ptr<Blob<Dtype> > >& blobs, int num) {
+    const int slot_id = free_.pop("Waiting for feature writer");
+    Slot& slot = slots_[slot_id];
+    slot.num = num;
+    for (int i = 0; i < blobs.size(); ++i) {
+      const Dtype* data = blobs[i]->cpu_data();
+      slot.features[i].assign(data, data + blobs[i]->offset(num));
+    }
+    full_.push(slot_id);
+  }
+  // Waits for all the features to be written.
+  void Finish() {
+    full_.push(-1);
+    WaitForInternalThreadToExit();
+  }
+
+ protected:
+  struct Slot {
+    vector<vector<float> > features;
+    int num;
+  };
+
+  virtual void InternalThreadEntry() {
+    for (int slot_id = full_.pop(); slot_id >= 0; slot_id = full_.pop()) {
+      const Slot& slot = slots_[slot_id];
+      for (int i = 0; i < writers_.size(); ++i) {
+        const int dim = slot.features[i].size() / slot.num;
+        for (int n = 0; n < slot.num; ++n) {
+          writers_[i]->Write(&slot.features[i][n * dim], dim);
+        }
+      }
+      const int previous_count = count_;
+      count_ += slot.num;
+      if (count_ / 1000 != previous_count / 1000) {
+        LOG(ERROR) << "Extracted features of " << count_ << " query images"
+            << " for feature blobs " << boost::join(blob_names_, ",");
+      }
+      free_.push(slot_id);
+    }
+    for (int i = 0; i < writers_.size(); ++i) {
+      writers_[i]->Flush();
+    }
+  }
+
+  vector<shared_ptr<FeatureWriter> > writers_;
+  vector<string> blob_names_;
+  vector<Slot> slots_;
+  BlockingQueue<int> free_;
+  BlockingQueue<int> full_;
+  int count_;
+};
+
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv);
 
@@ -27,24 +286,44 @@ int main(int argc, char** argv) {
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
-  const int num_required_args = 6;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  // num_mini_batches is only given without --num_images.
+  const bool has_num_images = FLAGS_num_images > 0;
+  const int num_required_args = has_num_images ? 5 : 6;
+  if (has_num_images && argc > num_required_args
+      && strspn(argv[num_required_args], "0123456789")
+         == strlen(argv[num_required_args])) {
+    LOG(ERROR) << "Give either num_mini_batches or --num_images, not both";
+    return 1;
+  }
   if (argc < num_required_args) {
     LOG(ERROR)<<
     "This program takes in a trained network and an input data layer, and then"
     " extract features of the input data produced by the net.\n"
-    "Usage: extract_features  pretrained_net_param"
+    "Usage: extract_features  [--num_images=N]  pretrained_net_param"
     "  feature_extraction_proto_file  extract_feature_blob_name1[,name2,...]"
-    "  save_feature_leveldb_name1[,name2,...]  num_mini_batches  [CPU/GPU]"
-    "  [DEVICE_ID=0]\n"
+    "  save_feature_dataset_name1[,name2,...]  [num_mini_batches]"
+    "  [leveldb/lmdb/recordfile/hdf5/flat]  [CPU/GPU]  [DEVICE_ID=0]\n"
+    "num_mini_batches is required, unless --num_images is given instead.\n"
     "Note: you can extract multiple features in one pass by specifying"
-    " multiple feature blob names and leveldb names seperated by ','."
+    " multiple feature blob names and dataset names seperated by ','."
     " The names cannot contain white space characters and the number of blobs"
-    " and leveldbs must be equal.";
+    " and datasets must be equal. The datasets are leveldbs by default."
+    " hdf5 writes a num x dim float dataset named data, and flat a float"
+    " flat dataset that can be mapped in memory.";
     return 1;
   }
   int arg_pos = num_required_args;
-
-  arg_pos = num_required_args;
+  string db_backend = "leveldb";
+  if (argc > arg_pos && strcmp(argv[arg_pos], "CPU") != 0
+      && strcmp(argv[arg_pos], "GPU") != 0) {
+    db_backend = argv[arg_pos++];
+  }
   if (argc > arg_pos && strcmp(argv[arg_pos], "GPU") == 0) {
     LOG(ERROR)<< "Using GPU";
     uint device_id = 0;
@@ -100,91 +379,55 @@ int feature_extraction_pipeline(int argc, char** argv) {
   vector<string> blob_names;
   boost::split(blob_names, extract_feature_blob_names, boost::is_any_of(","));
 
-  string save_feature_leveldb_names(argv[++arg_pos]);
-  vector<string> leveldb_names;
-  boost::split(leveldb_names, save_feature_leveldb_names,
+  string save_feature_dataset_names(argv[++arg_pos]);
+  vector<string> dataset_names;
+  boost::split(dataset_names, save_feature_dataset_names,
                boost::is_any_of(","));
-  CHECK_EQ(blob_names.size(), leveldb_names.size()) <<
-      " the number of blob names and leveldb names must be equal";
+  CHECK_EQ(blob_names.size(), dataset_names.size()) <<
+      " the number of blob names and dataset names must be equal";
   size_t num_features = blob_names.size();
 
+  vector<shared_ptr<Blob<Dtype> > > feature_blobs;
   for (size_t i = 0; i < num_features; i++) {
     CHECK(feature_extraction_net->has_blob(blob_names[i]))
         << "Unknown feature blob name " << blob_names[i]
         << " in the network " << feature_extraction_proto;
+    feature_blobs.push_back(
+        feature_extraction_net->blob_by_name(blob_names[i]));
   }
 
-  leveldb::Options options;
-  options.error_if_exists = true;
-  options.create_if_missing = true;
-  options.write_buffer_size = 268435456;
-  vector<shared_ptr<leveldb::DB> > feature_dbs;
+  vector<shared_ptr<FeatureWriter> > writers;
   for (size_t i = 0; i < num_features; ++i) {
-    LOG(INFO)<< "Opening leveldb " << leveldb_names[i];
-    leveldb::DB* db;
-    leveldb::Status status = leveldb::DB::Open(options,
-                                               leveldb_names[i].c_str(),
-                                               &db);
-    CHECK(status.ok()) << "Failed to open leveldb " << leveldb_names[i];
-    feature_dbs.push_back(shared_ptr<leveldb::DB>(db));
+    LOG(INFO)<< "Opening dataset " << dataset_names[i];
+    writers.push_back(shared_ptr<FeatureWriter>(
+        GetFeatureWriter(db_backend, dataset_names[i])));
   }
 
-  int num_mini_batches = atoi(argv[++arg_pos]);
+  const int batch_size = feature_blobs[0]->num();
+  const int num_images = has_num_images ? FLAGS_num_images :
+      atoi(argv[++arg_pos]) * batch_size;
 
   LOG(ERROR)<< "Extacting Features";
 
-  Datum datum;
-  vector<shared_ptr<leveldb::WriteBatch> > feature_batches(
-      num_features,
-      shared_ptr<leveldb::WriteBatch>(new leveldb::WriteBatch()));
-  const int kMaxKeyStrLength = 100;
-  char key_str[kMaxKeyStrLength];
+  // Double buffered: the features of a batch are written while the net
+  // computes the next one.
+  AsyncFeatureWriter async_writer(writers, blob_names, 2);
+  CHECK(async_writer.StartInternalThread())
+      << "Failed to start the feature writer thread";
   vector<Blob<float>*> input_vec;
-  vector<int> image_indices(num_features, 0);
-  for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index) {
+  for (int image_index = 0; image_index < num_images;
+      image_index += batch_size) {
     feature_extraction_net->Forward(input_vec);
-    for (int i = 0; i < num_features; ++i) {
-      const shared_ptr<Blob<Dtype> > feature_blob = feature_extraction_net
-          ->blob_by_name(blob_names[i]);
-      int batch_size = feature_blob->num();
-      int dim_features = feature_blob->count() / batch_size;
-      Dtype* feature_blob_data;
-      for (int n = 0; n < batch_size; ++n) {
-        datum.set_height(dim_features);
-        datum.set_width(1);
-        datum.set_channels(1);
-        datum.clear_data();
-        datum.clear_float_data();
-        feature_blob_data = feature_blob->mutable_cpu_data() +
-            feature_blob->offset(n);
-        for (int d = 0; d < dim_features; ++d) {
-          datum.add_float_data(feature_blob_data[d]);
-        }
-        string value;
-        datum.SerializeToString(&value);
-        snprintf(key_str, kMaxKeyStrLength, "%d", image_indices[i]);
-        feature_batches[i]->Put(string(key_str), value);
-        ++image_indices[i];
-        if (image_indices[i] % 1000 == 0) {
-          feature_dbs[i]->Write(leveldb::WriteOptions(),
-                                feature_batches[i].get());
-          LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-              " query images for feature blob " << blob_names[i];
-          feature_batches[i].reset(new leveldb::WriteBatch());
-        }
-      }  // for (int n = 0; n < batch_size; ++n)
-    }  // for (int i = 0; i < num_features; ++i)
-  }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
-  // write the last batch
+    async_writer.Write(feature_blobs,
+        std::min(batch_size, num_images - image_index));
+  }
+  async_writer.Finish();
   for (int i = 0; i < num_features; ++i) {
-    if (image_indices[i] % 1000 != 0) {
-      feature_dbs[i]->Write(leveldb::WriteOptions(), feature_batches[i].get());
-    }
-    LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
+    writers[i]->Close();
+    LOG(ERROR)<< "Extracted features of " << num_images <<
         " query images for feature blob " << blob_names[i];
   }
 
   LOG(ERROR)<< "Successfully extracted the features!";
   return 0;
 }
-